@@ -13,6 +13,7 @@
 
 #include "hittable.h"
 #include "ray.h"
+#include "simd.h"
 
 
 inline float ffmin(float a, float b) { return a < b ? a : b; }
@@ -27,11 +28,13 @@ class aabb {
         vec3 max() const {return _max; }
 
         bool hit(const ray& r, float tmin, float tmax) const {
+            return hit(ray_inv(r), tmin, tmax);
+        }
+
+        bool hit(const ray_inv& r, float tmin, float tmax) const {
             for (int a = 0; a < 3; a++) {
-                float t0 = ffmin((_min[a] - r.origin()[a]) / r.direction()[a],
-                                (_max[a] - r.origin()[a]) / r.direction()[a]);
-                float t1 = ffmax((_min[a] - r.origin()[a]) / r.direction()[a],
-                                (_max[a] - r.origin()[a]) / r.direction()[a]);
+                float t0 = ((r.near[a] ? _max : _min)[a] - r.o[a]) * r.inv[a];
+                float t1 = ((r.near[a] ? _min : _max)[a] - r.o[a]) * r.inv[a];
                 tmin = ffmax(t0, tmin);
                 tmax = ffmin(t1, tmax);
                 if (tmax <= tmin)
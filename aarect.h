@@ -15,14 +15,60 @@
 #include "random.h"
 
 
+// The lanes of p whose ray meets the plane where axis is k within [t_min,
+// t_max[lane]], inside [a0, a1] x [b0, b1] on the other two axes in order,
+// all tested together. The rects' hit then fills in the records.
+inline int rect_lanes(const ray_packet& p, int lanes, float t_min, const float *t_max, int axis,
+                      float k, float a0, float a1, float b0, float b1) {
+    const float *o[3] = { p.ox, p.oy, p.oz };
+    const float *d[3] = { p.dx, p.dy, p.dz };
+    int a = axis == 0 ? 1 : 0;
+    int b = axis == 2 ? 1 : 2;
+    int crossing = 0;
+    for (int l = 0; l < packet_size; l++) {
+        float t = (k - o[axis][l]) / d[axis][l];
+        float x = o[a][l] + t*d[a][l];
+        float y = o[b][l] + t*d[b][l];
+        bool in = t >= t_min && t <= t_max[l] && x >= a0 && x <= a1 && y >= b0 && y <= b1;
+        crossing |= int(in) << l;
+    }
+    return lanes & crossing;
+}
+
 class xy_rect: public hittable  {
     public:
         xy_rect() {}
         xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, material *mat) : x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int crossing = rect_lanes(p, lanes, t_min, t_max, 2, k, x0, x1, y0, y1);
+            return hittable::hit_packet(p, crossing, t_min, t_max, rec);
+        }
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
                box =  aabb(vec3(x0,y0, k-0.0001), vec3(x1, y1, k+0.0001));
                return true; }
+        virtual float  pdf_value(const vec3& o, const vec3& v) const {
+            hit_record rec;
+            if (this->hit(ray(o, v), 0.001, FLT_MAX, rec)) {
+                float area = (x1-x0)*(y1-y0);
+                float distance_squared = rec.t * rec.t * v.squared_length();
+                float cosine = fabs(dot(v, rec.normal) / v.length());
+                return  distance_squared / (cosine * area);
+            }
+            else
+                return 0;
+        }
+        virtual vec3 random(const vec3& o) const {
+            vec3 random_point = vec3(x0 + random_double()*(x1-x0), y0 + random_double()*(y1-y0), k);
+            return random_point - o;
+        }
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            if (emits_light(mp))
+                lights.push_back(this);
+        }
+        virtual float light_power() const {
+            return (x1-x0)*(y1-y0) * emitted_luminance(mp, vec3(0.5f*(x0+x1), 0.5f*(y0+y1), k));
+        }
         material  *mp;
         float x0, x1, y0, y1, k;
 };
@@ -32,6 +78,10 @@ class xz_rect: public hittable  {
         xz_rect() {}
         xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, material *mat) : x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int crossing = rect_lanes(p, lanes, t_min, t_max, 1, k, x0, x1, z0, z1);
+            return hittable::hit_packet(p, crossing, t_min, t_max, rec);
+        }
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
             box =  aabb(vec3(x0,k-0.0001,z0), vec3(x1, k+0.0001, z1));
             return true; 
@@ -51,6 +101,13 @@ class xz_rect: public hittable  {
             vec3 random_point = vec3(x0 + random_double()*(x1-x0), k,  z0 + random_double()*(z1-z0)); 
             return random_point - o;
         }
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            if (emits_light(mp))
+                lights.push_back(this);
+        }
+        virtual float light_power() const {
+            return (x1-x0)*(z1-z0) * emitted_luminance(mp, vec3(0.5f*(x0+x1), k, 0.5f*(z0+z1)));
+        }
         material  *mp;
         float x0, x1, z0, z1, k;
 };
@@ -60,9 +117,35 @@ class yz_rect: public hittable  {
         yz_rect() {}
         yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, material *mat) : y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int crossing = rect_lanes(p, lanes, t_min, t_max, 0, k, y0, y1, z0, z1);
+            return hittable::hit_packet(p, crossing, t_min, t_max, rec);
+        }
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
                box =  aabb(vec3(k-0.0001, y0, z0), vec3(k+0.0001, y1, z1));
                return true; }
+        virtual float  pdf_value(const vec3& o, const vec3& v) const {
+            hit_record rec;
+            if (this->hit(ray(o, v), 0.001, FLT_MAX, rec)) {
+                float area = (y1-y0)*(z1-z0);
+                float distance_squared = rec.t * rec.t * v.squared_length();
+                float cosine = fabs(dot(v, rec.normal) / v.length());
+                return  distance_squared / (cosine * area);
+            }
+            else
+                return 0;
+        }
+        virtual vec3 random(const vec3& o) const {
+            vec3 random_point = vec3(k, y0 + random_double()*(y1-y0), z0 + random_double()*(z1-z0));
+            return random_point - o;
+        }
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            if (emits_light(mp))
+                lights.push_back(this);
+        }
+        virtual float light_power() const {
+            return (y1-y0)*(z1-z0) * emitted_luminance(mp, vec3(k, 0.5f*(y0+y1), 0.5f*(z0+z1)));
+        }
         material  *mp;
         float y0, y1, z0, z1, k;
 };
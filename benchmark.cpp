@@ -0,0 +1,366 @@
+// Renders each built-in scene at a fixed resolution, sample count and seed and
+// prints the timings as JSON, so runs from different versions can be compared.
+//
+//   benchmark [--width N] [--height N] [--spp N] [--seed N] [--threads N]
+//             [--packets 0|1] [--wavefront 0|1] [--motion-segments N]
+//             [--texture-budget-mb N] [--check 1]
+//             [--scene NAME]... [--out FILE]
+//
+// --check 1 only checks the packed primitive sets and triangle meshes against
+// the shapes they hold, and exits with 1 if any ray disagrees.
+//
+// The wavefront engine has no per-pixel times, so pixel_us is null with it.
+// mesh_bytes_per_triangle, the triangle_mesh memory over its triangles, is null
+// for scenes without meshes.
+//
+// Build it like main.cpp, with benchmark.cpp in its place.
+
+#ifdef _MSC_VER
+#include "msc.h"
+#endif
+
+#include "integrator.h"
+#include "render.h"
+#include "scenes.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+struct benchmark_scene {
+	const char *name;
+	hittable *(*make)();
+	path_estimator mode;
+	vec3 lookfrom;
+	vec3 lookat;
+	float vfov;
+};
+
+// The scene TheRestOfYourLife renders.
+hittable *cornell_box_sampled() {
+	hittable *world;
+	camera *cam;
+	cornell_box(&world, &cam, 1);
+	return world;
+}
+
+// Cameras follow the drivers in main.cpp and the books, without depth of field.
+// Scenes with emitters use the pdf-sampled materials and light sampling of
+// TheRestOfYourLife.
+benchmark_scene benchmark_scenes[] = {
+	{ "random_scene_InOneWeekend", random_scene_InOneWeekend, estimator_InOneWeekend, vec3(13, 2, 3), vec3(0, 0, 0), 40 },
+	{ "two_spheres", two_spheres, estimator_InOneWeekend, vec3(13, 2, 3), vec3(0, 0, 0), 20 },
+	{ "two_perlin_spheres", two_perlin_spheres, estimator_InOneWeekend, vec3(13, 2, 3), vec3(0, 0, 0), 20 },
+	{ "random_scene", random_scene, estimator_InOneWeekend, vec3(13, 2, 3), vec3(0, 0, 0), 20 },
+	{ "simple_light", simple_light, estimator_TheRestOfYourLife, vec3(26, 3, 6), vec3(0, 2, 0), 20 },
+	{ "cornell_box", cornell_box, estimator_TheRestOfYourLife, vec3(278, 278, -800), vec3(278, 278, 0), 40 },
+	{ "cornell_balls", cornell_balls, estimator_TheRestOfYourLife, vec3(278, 278, -800), vec3(278, 278, 0), 40 },
+	{ "cornell_smoke", cornell_smoke, estimator_TheRestOfYourLife, vec3(278, 278, -800), vec3(278, 278, 0), 40 },
+	{ "cornell_final", cornell_final, estimator_TheRestOfYourLife, vec3(278, 278, -800), vec3(278, 278, 0), 40 },
+	{ "final", final, estimator_TheRestOfYourLife, vec3(478, 278, -600), vec3(278, 278, 0), 40 },
+	{ "forest", forest, estimator_InOneWeekend, vec3(-10, 12, -10), vec3(60, 0, 60), 40 },
+	{ "terrain", terrain, estimator_InOneWeekend, vec3(-40, 25, -45), vec3(0, 2, 0), 40 },
+	{ "cornell_box_sampled", cornell_box_sampled, estimator_TheRestOfYourLife, vec3(278, 278, -800), vec3(278, 278, 0), 40 },
+};
+
+// Peak resident set size of the process so far, in MB.
+double peak_rss_mb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize / 1048576.0;
+	return 0;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1048576.0;  // bytes
+#else
+	return usage.ru_maxrss / 1024.0;     // kilobytes
+#endif
+#endif
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// x with the given number of decimals, or null for an infinity or NaN, which
+// JSON has no way to write.
+std::string json_number(double x, int decimals) {
+	if (!isfinite(x))
+		return "null";
+	char text[64];
+	snprintf(text, sizeof(text), "%.*f", decimals, x);
+	return text;
+}
+
+float percentile(std::vector<float>& values, double p) {
+	size_t k = size_t(p * (values.size() - 1) + 0.5);
+	std::nth_element(values.begin(), values.begin() + k, values.end());
+	return values[k];
+}
+
+// Counts the rays on which set's closest hit, one ray at a time and in packets,
+// differs from the closest over the n shapes it was built from.
+int check_against(const char *name, hittable *set, hittable **shapes, int n) {
+	int failures = 0;
+	for (int p = 0; p < 64; p++) {
+		ray_packet packet;
+		float t_packet[packet_size];
+		hit_record recs[packet_size];
+		float expected[packet_size];
+		for (int k = 0; k < packet_size; k++) {
+			// from anywhere in the cluster, including the shared centre
+			vec3 o = p == 0 ? vec3(0, 0, 0) : 30 * (vec3(random_double(), random_double(), random_double()) - vec3(0.5, 0.5, 0.5));
+			ray r(o, unit_vector(vec3(random_double(), random_double(), random_double()) - vec3(0.5, 0.5, 0.5)), 0);
+			packet.set(k, r);
+			t_packet[k] = FLT_MAX;
+			expected[k] = FLT_MAX;
+			hit_record rec;
+			for (int i = 0; i < n; i++)
+				if (shapes[i]->hit(r, 0.001, expected[k], rec))
+					expected[k] = rec.t;
+			float t = FLT_MAX;
+			if (set->hit(r, 0.001, FLT_MAX, rec))
+				t = rec.t;
+			if (fabs(t - expected[k]) > 1e-3f * (1 + fabs(expected[k])))
+				failures++;
+		}
+		int hits = set->hit_packet(packet, (1 << packet_size) - 1, 0.001, t_packet, recs);
+		for (int k = 0; k < packet_size; k++) {
+			float t = hits >> k & 1 ? t_packet[k] : FLT_MAX;
+			if (fabs(t - expected[k]) > 1e-3f * (1 + fabs(expected[k])))
+				failures++;
+		}
+	}
+	if (failures)
+		fprintf(stderr, "%s: %d rays disagree with the shapes it holds\n", name, failures);
+	return failures;
+}
+
+// Sets whose shapes all share one centroid, which no split separates, so their
+// leaves are far wider than bvh_width. Returns the number of wrong hits.
+int check_coincident_leaves() {
+	scene_arena arena;
+	scene_arena_scope scope(arena);
+	seed_random(1);
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	const int n = 40;
+	sphere_set *spheres = scene_new<sphere_set>();
+	hittable **sphere_list = scene_array<hittable*>(n);
+	for (int i = 0; i < n; i++) {
+		float r = 1 + float((i * 7) % n);  // shuffled, so the nearest is not first
+		spheres->add(vec3(0, 0, 0), r, white);
+		sphere_list[i] = scene_new<sphere>(vec3(0, 0, 0), r, white);
+	}
+	spheres->build();
+	box_set *boxes = scene_new<box_set>();
+	hittable **box_list = scene_array<hittable*>(n);
+	for (int i = 0; i < n; i++) {
+		vec3 half = vec3(1, 1, 1) + vec3(float((i * 7) % n), float((i * 11) % n), float((i * 13) % n)) / 4;
+		boxes->add(-half, half, white);
+		box_list[i] = scene_new<box>(-half, half, white);
+	}
+	boxes->build();
+	return check_against("sphere_set", spheres, sphere_list, n) + check_against("box_set", boxes, box_list, n);
+}
+
+// Meshes against each of their triangles on its own, as a mesh of one, which
+// has no tree to search: a steep height field, and a soup of large
+// overlapping triangles whose nearest hit is rarely in the first leaf tried.
+// Returns the number of wrong hits.
+int check_meshes() {
+	scene_arena arena;
+	scene_arena_scope scope(arena);
+	seed_random(1);
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	triangle_mesh *meshes[2];
+	meshes[0] = terrain_mesh(16, 24, 8, white);
+	mesh_buffers *soup = scene_new<mesh_buffers>();
+	std::vector<mesh_triangle> soup_tris;
+	for (int t = 0; t < 300; t++) {
+		vec3 centre = 24 * (vec3(random_double(), random_double(), random_double()) - vec3(0.5, 0.5, 0.5));
+		mesh_triangle tri;
+		for (int k = 0; k < 3; k++) {
+			tri.v[k] = int(soup->positions.size());
+			soup->positions.push_back(centre + 8 * (vec3(random_double(), random_double(), random_double()) - vec3(0.5, 0.5, 0.5)));
+		}
+		soup_tris.push_back(tri);
+	}
+	meshes[1] = scene_new<triangle_mesh>(soup, soup_tris, white);
+	const char *names[2] = { "terrain triangle_mesh", "soup triangle_mesh" };
+	int failures = 0;
+	for (int m = 0; m < 2; m++) {
+		const std::vector<mesh_triangle>& tris = meshes[m]->triangles;
+		int n = int(tris.size());
+		hittable **single = scene_array<hittable*>(n);
+		for (int t = 0; t < n; t++)
+			single[t] = scene_new<triangle_mesh>(meshes[m]->buffers, std::vector<mesh_triangle>(1, tris[t]), white);
+		failures += check_against(names[m], meshes[m], single, n);
+	}
+	return failures;
+}
+
+void run_scene(const benchmark_scene& scene, int nx, int ny, int ns, uint64_t seed, FILE *json, bool first) {
+	seed_random(seed);
+	render_seed = seed;
+	bvh_build_seconds = 0;
+	mesh_triangles_built = 0;
+	mesh_bytes_built = 0;
+	scene_arena arena;
+	scene_arena_scope scope(arena);
+	texture_cache_stats textures = shared_texture_cache().stats();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	hittable *world = scene.make();
+	double setup = seconds_since(start);
+	double bvh_build = bvh_build_seconds;
+	long long mesh_triangles = mesh_triangles_built, mesh_bytes = mesh_bytes_built;
+	// what a frame of an animation would pay instead of bvh_build
+	start = std::chrono::steady_clock::now();
+	world->update_bounds(0.0, 1.0);
+	double refit = seconds_since(start);
+
+	camera cam(scene.lookfrom, scene.lookat, vec3(0, 1, 0), scene.vfov, float(nx) / float(ny), 0.0, 10.0, 0.0, 1.0);
+	light_list lights(world);
+
+	framebuffer fb(nx, ny);
+	std::vector<float> pixel_us;
+	std::vector<long long> pixel_rays;
+	long long rays = 0;
+	start = std::chrono::steady_clock::now();
+	if (wavefront)
+		render_wavefront(fb, ns, cam, world, &lights, scene.mode, 0, &rays);
+	else {
+		pixel_us.resize(size_t(nx) * ny);
+		pixel_rays.resize(size_t(nx) * ny);
+		render_tiles(fb, [&](int i, int j) {
+			std::chrono::steady_clock::time_point pixel_start = std::chrono::steady_clock::now();
+			long long traced = 0;
+			vec3 col(0, 0, 0);
+			for (int s = 0; s < ns; s += packet_size) {
+				int n = ns - s < packet_size ? ns - s : packet_size;
+				vec3 cols[packet_size];
+				trace_samples(cam, nx, ny, i, j, s, n, world, &lights, scene.mode, cols, &traced);
+				for (int k = 0; k < n; k++)
+					col += cols[k];
+			}
+			size_t p = size_t(j) * nx + i;
+			pixel_rays[p] = traced;
+			pixel_us[p] = float(1e6 * seconds_since(pixel_start));
+			return col / float(ns);
+		});
+	}
+	double render = seconds_since(start);
+
+	for (size_t p = 0; p < pixel_rays.size(); p++)
+		rays += pixel_rays[p];
+	vec3 mean(0, 0, 0);
+	for (size_t p = 0; p < fb.pixels.size(); p++)
+		mean += fb.pixels[p];
+	mean /= float(fb.pixels.size());
+	double samples = double(nx) * ny * ns;
+
+	fprintf(json, "%s    {\n", first ? "" : ",\n");
+	fprintf(json, "      \"name\": \"%s\",\n", scene.name);
+	fprintf(json, "      \"setup_ms\": %s,\n", json_number(1e3 * setup, 3).c_str());
+	fprintf(json, "      \"bvh_build_ms\": %s,\n", json_number(1e3 * bvh_build, 3).c_str());
+	fprintf(json, "      \"refit_ms\": %s,\n", json_number(1e3 * refit, 3).c_str());
+	fprintf(json, "      \"render_ms\": %s,\n", json_number(1e3 * render, 3).c_str());
+	fprintf(json, "      \"rays\": %lld,\n", rays);
+	fprintf(json, "      \"mrays_per_s\": %s,\n", json_number(rays / render / 1e6, 4).c_str());
+	fprintf(json, "      \"samples_per_s\": %s,\n", json_number(samples / render, 1).c_str());
+	if (pixel_us.empty())
+		fprintf(json, "      \"pixel_us\": null,\n");
+	else
+		fprintf(json, "      \"pixel_us\": { \"p50\": %s, \"p90\": %s, \"p99\": %s, \"max\": %s },\n",
+			json_number(percentile(pixel_us, 0.5), 2).c_str(), json_number(percentile(pixel_us, 0.9), 2).c_str(),
+			json_number(percentile(pixel_us, 0.99), 2).c_str(), json_number(percentile(pixel_us, 1.0), 2).c_str());
+	fprintf(json, "      \"scene_kb\": %.1f,\n", arena.bytes_used() / 1024.0);
+	fprintf(json, "      \"mesh_bytes_per_triangle\": %s,\n",
+		mesh_triangles ? json_number(double(mesh_bytes) / mesh_triangles, 2).c_str() : "null");
+	texture_cache_stats textures_after = shared_texture_cache().stats();
+	fprintf(json, "      \"texture_hits\": %lld,\n", textures_after.hits - textures.hits);
+	fprintf(json, "      \"texture_misses\": %lld,\n", textures_after.misses - textures.misses);
+	fprintf(json, "      \"texture_peak_kb\": %.1f,\n", textures_after.peak / 1024.0);
+	fprintf(json, "      \"peak_rss_mb\": %.1f,\n", peak_rss_mb());
+	fprintf(json, "      \"mean_radiance\": [%s, %s, %s]\n",
+		json_number(mean[0], 6).c_str(), json_number(mean[1], 6).c_str(), json_number(mean[2], 6).c_str());
+	fprintf(json, "    }");
+	fflush(json);
+}
+
+int main(int argc, char **argv) {
+	int nx = 200, ny = 200, ns = 16;
+	uint64_t seed = 0;
+	std::vector<std::string> only;
+	const char *out = 0;
+	bool check = false;
+	for (int a = 1; a < argc; a++) {
+		std::string arg = argv[a];
+		if (a + 1 >= argc) {
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return 1;
+		}
+		const char *value = argv[++a];
+		if (arg == "--width") nx = atoi(value);
+		else if (arg == "--height") ny = atoi(value);
+		else if (arg == "--spp") ns = atoi(value);
+		else if (arg == "--seed") seed = strtoull(value, 0, 10);
+		else if (arg == "--threads") render_threads = atoi(value);
+		else if (arg == "--packets") packet_tracing = atoi(value) != 0;
+		else if (arg == "--wavefront") wavefront = atoi(value) != 0;
+		else if (arg == "--motion-segments") bvh_motion_segments = atoi(value);
+		else if (arg == "--texture-budget-mb") texture_cache_budget = size_t(atof(value) * 1048576);
+		else if (arg == "--check") check = atoi(value) != 0;
+		else if (arg == "--scene") only.push_back(value);
+		else if (arg == "--out") out = value;
+		else {
+			fprintf(stderr, "unknown option %s\n", arg.c_str());
+			return 1;
+		}
+	}
+	if (check) {
+		int failures = check_coincident_leaves() + check_meshes();
+		printf("%s\n", failures ? "check failed" : "check passed");
+		return failures ? 1 : 0;
+	}
+	FILE *json = out ? fopen(out, "w") : stdout;
+	if (!json) {
+		fprintf(stderr, "could not open %s\n", out);
+		return 1;
+	}
+
+	fprintf(json, "{\n");
+	fprintf(json, "  \"width\": %d,\n  \"height\": %d,\n  \"spp\": %d,\n", nx, ny, ns);
+	fprintf(json, "  \"seed\": %llu,\n  \"threads\": %d,\n", (unsigned long long)seed, worker_count());
+	fprintf(json, "  \"packets\": %s,\n", packet_tracing ? "true" : "false");
+	fprintf(json, "  \"wavefront\": %s,\n", wavefront ? "true" : "false");
+	fprintf(json, "  \"scenes\": [\n");
+	bool first = true;
+	for (size_t k = 0; k < sizeof(benchmark_scenes) / sizeof(benchmark_scenes[0]); k++) {
+		const benchmark_scene& scene = benchmark_scenes[k];
+		if (!only.empty() && std::find(only.begin(), only.end(), scene.name) == only.end())
+			continue;
+		run_scene(scene, nx, ny, ns, seed, json, first);
+		first = false;
+	}
+	fprintf(json, "\n  ]\n}\n");
+	if (out)
+		fclose(json);
+}
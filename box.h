@@ -12,36 +12,108 @@
 //==================================================================================================
 
 #include "aarect.h"
-#include "hittable_list.h"
+#include "hittable.h"
+#include "scene_arena.h"
 
 
+// Where r first meets the surface of the box [lo, hi] within [t_min, t_max]:
+// where it enters, or where it leaves if it starts inside. One slab test;
+// axis and upper say which face, upper being the one at hi.
+inline bool box_slab(const ray& r, const vec3& lo, const vec3& hi, float t_min, float t_max,
+                     float& t, int& axis, bool& upper) {
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    float enter = -FLT_MAX, leave = FLT_MAX;
+    int enter_axis = 0, leave_axis = 0;
+    for (int a = 0; a < 3; a++) {
+        float t0 = (lo[a] - o[a]) / d[a];
+        float t1 = (hi[a] - o[a]) / d[a];
+        float near = ffmin(t0, t1), far = ffmax(t0, t1);
+        if (near > enter) {
+            enter = near;
+            enter_axis = a;
+        }
+        if (far < leave) {
+            leave = far;
+            leave_axis = a;
+        }
+    }
+    if (enter > leave)
+        return false;
+    if (enter >= t_min && enter <= t_max) {
+        t = enter;
+        axis = enter_axis;
+        upper = d[axis] < 0;
+    }
+    else if (leave >= t_min && leave <= t_max) {
+        t = leave;
+        axis = leave_axis;
+        upper = d[axis] > 0;
+    }
+    else
+        return false;
+    return true;
+}
+
+// The record for a hit at t on a face of [lo, hi]: the outward normal, and u, v
+// across the face along the other two axes in order, as the rects have them.
+inline void box_face(const ray& r, float t, const vec3& lo, const vec3& hi, int axis, bool upper,
+                     material *m, hit_record& rec) {
+    int a = axis == 0 ? 1 : 0;
+    int b = axis == 2 ? 1 : 2;
+    rec.t = t;
+    rec.p = r.point_at_parameter(t);
+    rec.u = (rec.p[a] - lo[a]) / (hi[a] - lo[a]);
+    rec.v = (rec.p[b] - lo[b]) / (hi[b] - lo[b]);
+    rec.normal = vec3(0, 0, 0);
+    rec.normal[axis] = upper ? 1 : -1;
+    rec.mat_ptr = m;
+}
+
+// The six faces of [p0, p1] as rects facing out, for light sampling.
+void collect_box_faces(const vec3& p0, const vec3& p1, material *m, std::vector<hittable*>& lights) {
+    lights.push_back(scene_new<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), m));
+    lights.push_back(scene_new<flip_normals>(scene_new<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), m)));
+    lights.push_back(scene_new<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), m));
+    lights.push_back(scene_new<flip_normals>(scene_new<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), m)));
+    lights.push_back(scene_new<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), m));
+    lights.push_back(scene_new<flip_normals>(scene_new<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), m)));
+}
+
+// An axis-aligned box. Its faces only exist as rects when it is a light.
 class box: public hittable  {
     public:
         box() {}
-        box(const vec3& p0, const vec3& p1, material *ptr);
+        box(const vec3& p0, const vec3& p1, material *ptr) : pmin(p0), pmax(p1), mp(ptr) {}
         virtual bool hit(const ray& r, float t0, float t1, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int hits = 0;
+            for (int k = 0; k < packet_size; k++)
+                if ((lanes >> k & 1) && box::hit(p.lane(k), t_min, t_max[k], rec[k])) {
+                    t_max[k] = rec[k].t;
+                    hits |= 1 << k;
+                }
+            return hits;
+        }
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
                box =  aabb(pmin, pmax);
                return true; }
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            if (emits_light(mp))
+                collect_box_faces(pmin, pmax, mp, lights);
+        }
         vec3 pmin, pmax;
-        hittable *list_ptr;
+        material *mp;
 };
 
-box::box(const vec3& p0, const vec3& p1, material *ptr) {
-    pmin = p0;
-    pmax = p1;
-    hittable **list = new hittable*[6];
-    list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr);
-    list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
-    list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr);
-    list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
-    list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr);
-    list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
-    list_ptr = new hittable_list(list,6);
-}
-
 bool box::hit(const ray& r, float t0, float t1, hit_record& rec) const {
-    return list_ptr->hit(r, t0, t1, rec);
+    float t;
+    int axis;
+    bool upper;
+    if (!box_slab(r, pmin, pmax, t0, t1, t, axis, upper))
+        return false;
+    box_face(r, t, pmin, pmax, axis, upper, mp, rec);
+    return true;
 }
 
 #endif
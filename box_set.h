@@ -0,0 +1,208 @@
+#ifndef BOXSETH
+#define BOXSETH
+
+#include "box.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "simd.h"
+
+#include <vector>
+
+
+// Many axis-aligned boxes as arrays of corners and materials, stored in leaf
+// slot order under their own BVH, whose leaves hold up to bvh_width boxes (more
+// where centres coincide and can't be split). A ray runs the slab test against
+// a leaf bvh_width boxes at once, one per vector lane, and a packet against one
+// box at a time, one ray per lane. Only the distance and the slot are kept
+// while searching; the face, normal and uv are worked out once, for the
+// closest hit. Call build after the last add.
+class box_set : public hittable {
+    public:
+        void add(const vec3& p0, const vec3& p1, material *m);
+        void build();
+        int size() const { return int(mat.size()); }
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual void collect_lights(std::vector<hittable*>& lights);
+        virtual void update_bounds(float t0, float t1);
+        virtual size_t memory_bytes() const;
+
+        // bvh_width spare empty boxes at the end, so a leaf can always be loaded in whole vectors
+        std::vector<float> lo[3], hi[3];
+        std::vector<material*> mat;
+        wide_tree wide;
+        float built_cost = 0;
+    private:
+        aabb slot_box(int slot) const {
+            return aabb(vec3(lo[0][slot], lo[1][slot], lo[2][slot]), vec3(hi[0][slot], hi[1][slot], hi[2][slot]));
+        }
+        void finish(const ray& r, int slot, float t, hit_record& rec) const;
+};
+
+void box_set::add(const vec3& p0, const vec3& p1, material *m) {
+    for (int a = 0; a < 3; a++) {
+        lo[a].push_back(p0[a]);
+        hi[a].push_back(p1[a]);
+    }
+    mat.push_back(m);
+}
+
+void box_set::build() {
+    int n = size();
+    std::vector<bvh_primitive> prims(n);
+    for (int i = 0; i < n; i++)
+        prims[i] = make_bvh_primitive(slot_box(i), i);
+    bvh_tree tree;
+    tree.max_leaf_size = bvh_width;
+    tree.leaf_batch = bvh_width;
+    tree.build(prims);
+    wide.collapse(tree);
+    built_cost = wide.sah_cost();
+    for (int a = 0; a < 3; a++) {
+        std::vector<float> sorted_lo(n + bvh_width, FLT_MAX), sorted_hi(n + bvh_width, -FLT_MAX);
+        for (int slot = 0; slot < n; slot++) {
+            sorted_lo[slot] = lo[a][tree.order[slot]];
+            sorted_hi[slot] = hi[a][tree.order[slot]];
+        }
+        lo[a].swap(sorted_lo);
+        hi[a].swap(sorted_hi);
+    }
+    std::vector<material*> m(n);
+    for (int slot = 0; slot < n; slot++)
+        m[slot] = mat[tree.order[slot]];
+    mat.swap(m);
+}
+
+// For boxes that have been moved by rewriting the arrays in place.
+void box_set::update_bounds(float t0, float t1) {
+    wide.refit([&](int slot) { return slot_box(slot); });
+    if (wide.sah_cost() > bvh_refit_limit * built_cost) {
+        for (int a = 0; a < 3; a++) {
+            lo[a].resize(size());
+            hi[a].resize(size());
+        }
+        build();
+    }
+}
+
+bool box_set::bounding_box(float t0, float t1, aabb& box) const {
+    if (mat.empty())
+        return false;
+    box = wide.bounds();
+    return true;
+}
+
+void box_set::collect_lights(std::vector<hittable*>& lights) {
+    for (int slot = 0; slot < size(); slot++)
+        if (emits_light(mat[slot]))
+            collect_box_faces(slot_box(slot).min(), slot_box(slot).max(), mat[slot], lights);
+}
+
+size_t box_set::memory_bytes() const {
+    size_t columns = 0;
+    for (int a = 0; a < 3; a++)
+        columns += lo[a].capacity() + hi[a].capacity();
+    return columns * sizeof(float) + mat.capacity() * sizeof(material*) + wide.memory_bytes();
+}
+
+void box_set::finish(const ray& r, int slot, float t, hit_record& rec) const {
+    aabb b = slot_box(slot);
+    int axis;
+    bool upper;
+    // the same slab test again, for the face
+    if (!box_slab(r, b.min(), b.max(), t, t, t, axis, upper)) {
+        axis = 0;
+        upper = false;
+    }
+    box_face(r, t, b.min(), b.max(), axis, upper, mat[slot], rec);
+}
+
+bool box_set::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    typedef simd_float<bvh_width>::type lanes;
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    lanes ro[3] = { lanes(o[0]), lanes(o[1]), lanes(o[2]) };
+    lanes rd[3] = { lanes(d[0]), lanes(d[1]), lanes(d[2]) };
+    int closest = -1;
+    float t_hit = t_max;
+    wide.intersect_leaves(r, t_min, t_max, [&](int first, int count, float& t_closest) {
+        bool hit_anything = false;
+        // a leaf of coincident centroids can hold more than bvh_width boxes
+        for (int chunk = first; chunk < first + count; chunk += bvh_width) {
+            int n = first + count - chunk < bvh_width ? first + count - chunk : bvh_width;
+            lanes enter(-FLT_MAX), leave(FLT_MAX);
+            for (int a = 0; a < 3; a++) {
+                lanes t0 = (lanes::load(&lo[a][chunk]) - ro[a]) / rd[a];
+                lanes t1 = (lanes::load(&hi[a][chunk]) - ro[a]) / rd[a];
+                enter = max(enter, min(t0, t1));
+                leave = min(leave, max(t0, t1));
+            }
+            int candidates = le_mask(enter, leave) & ((1 << n) - 1);
+            if (!candidates)
+                continue;
+            float t_enter[bvh_width], t_leave[bvh_width];
+            enter.store(t_enter);
+            leave.store(t_leave);
+            for (int k = 0; k < n; k++) {
+                if (!(candidates >> k & 1))
+                    continue;
+                float t = t_enter[k] >= t_min ? t_enter[k] : t_leave[k];
+                if (!(t >= t_min && t < t_closest))
+                    continue;
+                t_closest = t_hit = t;
+                closest = chunk + k;
+                hit_anything = true;
+            }
+        }
+        return hit_anything;
+    });
+    if (closest < 0)
+        return false;
+    finish(r, closest, t_hit, rec);
+    return true;
+}
+
+int box_set::hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+    typedef simd_float<packet_size>::type ray_lanes;
+    ray_lanes ro[3] = { ray_lanes::load(p.ox), ray_lanes::load(p.oy), ray_lanes::load(p.oz) };
+    ray_lanes rd[3] = { ray_lanes::load(p.dx), ray_lanes::load(p.dy), ray_lanes::load(p.dz) };
+    ray_lanes near_limit(t_min);
+    int closest[packet_size];
+    int hits = wide.intersect_packet(p, lanes, t_min, t_max, [&](int slot, int live) {
+        ray_lanes enter(-FLT_MAX), leave(FLT_MAX);
+        for (int a = 0; a < 3; a++) {
+            ray_lanes t0 = (ray_lanes(lo[a][slot]) - ro[a]) / rd[a];
+            ray_lanes t1 = (ray_lanes(hi[a][slot]) - ro[a]) / rd[a];
+            enter = max(enter, min(t0, t1));
+            leave = min(leave, max(t0, t1));
+        }
+        int candidates = le_mask(enter, leave) & live;
+        if (!candidates)
+            return 0;
+        ray_lanes far_limit = ray_lanes::load(t_max);
+        int enter_hits = candidates & le_mask(near_limit, enter) & lt_mask(enter, far_limit);
+        int leave_hits = candidates & ~le_mask(near_limit, enter) & le_mask(near_limit, leave) & lt_mask(leave, far_limit);
+        if (!(enter_hits | leave_hits))
+            return 0;
+        float te[packet_size], tl[packet_size];
+        enter.store(te);
+        leave.store(tl);
+        for (int k = 0; k < packet_size; k++) {
+            if (enter_hits >> k & 1)
+                t_max[k] = te[k];
+            else if (leave_hits >> k & 1)
+                t_max[k] = tl[k];
+            else
+                continue;
+            closest[k] = slot;
+        }
+        return enter_hits | leave_hits;
+    });
+    for (int k = 0; k < packet_size; k++)
+        if (hits >> k & 1)
+            finish(p.lane(k), closest[k], t_max[k], rec[k]);
+    return hits;
+}
+
+#endif
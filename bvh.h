@@ -11,6 +11,7 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include "bvh_build.h"
 #include "hittable.h"
 
 
@@ -18,8 +19,14 @@ class bvh_node : public hittable  {
     public:
         bvh_node() {}
         bvh_node(hittable **l, int n, float time0, float time1);
+        void build(hittable **l, bvh_primitive *prims, int n);
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            left->collect_lights(lights);
+            if (right != left)
+                right->collect_lights(lights);
+        }
         hittable *left;
         hittable *right;
         aabb box;
@@ -58,110 +65,56 @@ bool bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
 }
 
 
-int box_x_compare (const void * a, const void * b) {
-    aabb box_left, box_right;
-    hittable *ah = *(hittable**)a;
-    hittable *bh = *(hittable**)b;
-    if(!ah->bounding_box(0,0, box_left) || !bh->bounding_box(0,0, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    if ( box_left.min().x() - box_right.min().x() < 0.0  )
-        return -1;
-    else
-        return 1;
-}
-
-int box_y_compare (const void * a, const void * b)
-{
-    aabb box_left, box_right;
-    hittable *ah = *(hittable**)a;
-    hittable *bh = *(hittable**)b;
-    if(!ah->bounding_box(0,0, box_left) || !bh->bounding_box(0,0, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    if ( box_left.min().y() - box_right.min().y() < 0.0  )
-        return -1;
-    else
-        return 1;
-}
-int box_z_compare (const void * a, const void * b)
-{
-    aabb box_left, box_right;
-    hittable *ah = *(hittable**)a;
-    hittable *bh = *(hittable**)b;
-    if(!ah->bounding_box(0,0, box_left) || !bh->bounding_box(0,0, box_right))
-        std::cerr << "no bounding box in bvh_node constructor\n";
-    if ( box_left.min().z() - box_right.min().z() < 0.0  )
-        return -1;
-    else
-        return 1;
-}
-
-
 bvh_node::bvh_node(hittable **l, int n, float time0, float time1) {
-    aabb *boxes = new aabb[n];
-    float *left_area = new float[n];
-    float *right_area = new float[n];
-    aabb main_box;
-    bool dummy = l[0]->bounding_box(time0,time1,main_box);
-    for (int i = 1; i < n; i++) {
-        aabb new_box;
-        bool dummy = l[i]->bounding_box(time0,time1,new_box);
-        main_box = surrounding_box(new_box, main_box);
-    }
-    int axis = main_box.longest_axis();
-    if (axis == 0)
-        qsort(l, n, sizeof(hittable *), box_x_compare);
-    else if (axis == 1)
-        qsort(l, n, sizeof(hittable *), box_y_compare);
-    else
-        qsort(l, n, sizeof(hittable *), box_z_compare);
-    for (int i = 0; i < n; i++)
-        bool dummy = l[i]->bounding_box(time0,time1,boxes[i]);
-    left_area[0] = boxes[0].area();
-    aabb left_box = boxes[0];
-    for (int i = 1; i < n-1; i++) {
-        left_box = surrounding_box(left_box, boxes[i]);
-        left_area[i] = left_box.area();
+    bvh_primitive *prims = new bvh_primitive[n];
+    for (int i = 0; i < n; i++) {
+        aabb b;
+        if (!l[i]->bounding_box(time0, time1, b))
+            std::cerr << "no bounding box in bvh_node constructor\n";
+        prims[i] = make_bvh_primitive(b, i);
     }
-    right_area[n-1] = boxes[n-1].area();
-    aabb right_box = boxes[n-1];
-    for (int i = n-2; i > 0; i--) {
-        right_box = surrounding_box(right_box, boxes[i]);
-        right_area[i] = right_box.area();
-    }
-    float min_SAH = FLT_MAX;
-    int min_SAH_idx;
-    for (int i = 0; i < n-1; i++) {
-        float SAH = i*left_area[i] + (n-i-1)*right_area[i+1];
-        if (SAH < min_SAH) {
-            min_SAH_idx = i;
-            min_SAH = SAH;
-        }
-    }
-
-    /*
-    if (min_SAH_idx == 0)
-        left = l[0];
-    else
-        left = new bvh_node(l, min_SAH_idx+1, time0, time1);
-    if (min_SAH_idx == n-2)
-        right = l[min_SAH_idx+1];
-    else
-        right = new bvh_node(l + min_SAH_idx+1, n - min_SAH_idx -1, time0, time1);
-    */
+    build(l, prims, n);
+    delete [] prims;
+}
 
+// Splits at the cheapest binned SAH boundary, or in half when all the
+// centroids coincide. Bounds come from prims, so each object is asked once.
+void bvh_node::build(hittable **l, bvh_primitive *prims, int n) {
+    box = empty_box();
+    aabb centroids = empty_box();
+    for (int i = 0; i < n; i++) {
+        grow_box(box, prims[i].box);
+        grow_box(centroids, prims[i].centroid);
+    }
     if (n == 1) {
-        left = right = l[0];
+        left = right = l[prims[0].index];
     }
     else if (n == 2) {
-        left = l[0];
-        right = l[1];
+        left = l[prims[0].index];
+        right = l[prims[1].index];
     }
     else {
-        left = new bvh_node(l, n/2, time0, time1);
-        right = new bvh_node(l + n/2, n - n/2, time0, time1);
+        int mid, axis;
+        float cost;
+        if (!bvh_binned_split(prims, n, box, centroids, mid, axis, cost))
+            mid = n/2;
+        if (mid == 1) {
+            left = l[prims[0].index];
+        }
+        else {
+            bvh_node *node = scene_new<bvh_node>();
+            node->build(l, prims, mid);
+            left = node;
+        }
+        if (n - mid == 1) {
+            right = l[prims[mid].index];
+        }
+        else {
+            bvh_node *node = scene_new<bvh_node>();
+            node->build(l, prims + mid, n - mid);
+            right = node;
+        }
     }
-
-    box = main_box;
 }
 
 #endif
@@ -0,0 +1,227 @@
+#ifndef BVHBUILDH
+#define BVHBUILDH
+
+#include "hittable.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <float.h>
+#include <vector>
+
+
+// Surface area heuristic costs, relative to one bounding box test.
+float bvh_traversal_cost = 1.0f;
+float bvh_intersection_cost = 1.0f;
+const int bvh_bin_count = 32;
+int bvh_parallel_threshold = 4096;  // smallest range split across threads
+
+struct bvh_primitive {
+    aabb box;
+    vec3 centroid;
+    int index;
+};
+
+inline bvh_primitive make_bvh_primitive(const aabb& box, int index) {
+    bvh_primitive p;
+    p.box = box;
+    p.centroid = 0.5f*(box.min() + box.max());
+    p.index = index;
+    return p;
+}
+
+inline aabb empty_box() {
+    return aabb(vec3(FLT_MAX, FLT_MAX, FLT_MAX), vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+}
+
+inline void grow_box(aabb& box, const aabb& b) {
+    for (int a = 0; a < 3; a++) {
+        if (b._min[a] < box._min[a]) box._min[a] = b._min[a];
+        if (b._max[a] > box._max[a]) box._max[a] = b._max[a];
+    }
+}
+
+inline void grow_box(aabb& box, const vec3& p) {
+    grow_box(box, aabb(p, p));
+}
+
+struct bvh_bins {
+    float lo[3][bvh_bin_count][3];
+    float hi[3][bvh_bin_count][3];
+    int count[3][bvh_bin_count];
+};
+
+void clear_bins(bvh_bins& bins, int nbins) {
+    for (int k = 0; k < 3; k++)
+        for (int b = 0; b < nbins; b++) {
+            for (int a = 0; a < 3; a++) {
+                bins.lo[k][b][a] = FLT_MAX;
+                bins.hi[k][b][a] = -FLT_MAX;
+            }
+            bins.count[k][b] = 0;
+        }
+}
+
+void fill_bins(bvh_bins& bins, int nbins, const bvh_primitive *prims, int count,
+               const float lo[3], const float scale[3]) {
+    for (int i = 0; i < count; i++) {
+        const bvh_primitive& p = prims[i];
+        for (int k = 0; k < 3; k++) {
+            int b = int((p.centroid.e[k] - lo[k]) * scale[k]);
+            if (b > nbins - 1) b = nbins - 1;
+            bins.count[k][b]++;
+            for (int a = 0; a < 3; a++) {
+                if (p.box._min.e[a] < bins.lo[k][b][a]) bins.lo[k][b][a] = p.box._min.e[a];
+                if (p.box._max.e[a] > bins.hi[k][b][a]) bins.hi[k][b][a] = p.box._max.e[a];
+            }
+        }
+    }
+}
+
+// Bounds of prims[0, count) and of their centroids, reduced over workers chunks.
+void bvh_bounds(const bvh_primitive *prims, int count, aabb& box, aabb& centroids, int workers = 1) {
+    box = empty_box();
+    centroids = empty_box();
+    int chunks = workers > 1 && count >= bvh_parallel_threshold ? workers : 1;
+    if (chunks == 1) {
+        for (int i = 0; i < count; i++) {
+            grow_box(box, prims[i].box);
+            grow_box(centroids, prims[i].centroid);
+        }
+        return;
+    }
+    std::vector<aabb> boxes(chunks, empty_box()), cents(chunks, empty_box());
+    parallel_for(chunks, [&](int c) {
+        int begin = int((long long)count * c / chunks), end = int((long long)count * (c + 1) / chunks);
+        for (int i = begin; i < end; i++) {
+            grow_box(boxes[c], prims[i].box);
+            grow_box(cents[c], prims[i].centroid);
+        }
+    }, chunks);
+    for (int c = 0; c < chunks; c++) {
+        grow_box(box, boxes[c]);
+        grow_box(centroids, cents[c]);
+    }
+}
+
+// Bins the centroids of prims[0, count) along all three axes and finds the bin
+// boundary with the lowest SAH cost. On success the prims are partitioned around
+// it, mid is the size of the left side, axis the split axis and cost the cost
+// of the split node. Returns false when every centroid falls in one bin, leaving
+// prims untouched. Large ranges are binned and partitioned on up to workers threads.
+bool bvh_binned_split(bvh_primitive *prims, int count, const aabb& box, const aabb& centroids,
+                      int& mid, int& axis, float& cost, int workers = 1) {
+    // small nodes do not need more bins than they have primitives
+    int nbins = count < bvh_bin_count ? (count > 4 ? count : 4) : bvh_bin_count;
+    int chunks = workers > 1 && count >= bvh_parallel_threshold ? workers : 1;
+    float lo[3], scale[3];
+    for (int k = 0; k < 3; k++) {
+        lo[k] = centroids.min()[k];
+        float extent = centroids.max()[k] - lo[k];
+        scale[k] = extent > 0 ? nbins / extent : 0;
+    }
+    bvh_bins bins;
+    clear_bins(bins, nbins);
+    if (chunks == 1) {
+        fill_bins(bins, nbins, prims, count, lo, scale);
+    }
+    else {
+        std::vector<bvh_bins> chunk_bins(chunks);
+        parallel_for(chunks, [&](int c) {
+            int begin = int((long long)count * c / chunks), end = int((long long)count * (c + 1) / chunks);
+            clear_bins(chunk_bins[c], nbins);
+            fill_bins(chunk_bins[c], nbins, prims + begin, end - begin, lo, scale);
+        }, chunks);
+        for (int c = 0; c < chunks; c++)
+            for (int k = 0; k < 3; k++)
+                for (int b = 0; b < nbins; b++) {
+                    for (int a = 0; a < 3; a++) {
+                        bins.lo[k][b][a] = ffmin(bins.lo[k][b][a], chunk_bins[c].lo[k][b][a]);
+                        bins.hi[k][b][a] = ffmax(bins.hi[k][b][a], chunk_bins[c].hi[k][b][a]);
+                    }
+                    bins.count[k][b] += chunk_bins[c].count[k][b];
+                }
+    }
+
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_bin = 0;
+    float inv_area = box.area() > 0 ? 1.0f / box.area() : 0.0f;
+    for (int k = 0; k < 3; k++) {
+        if (scale[k] == 0)
+            continue;
+        // right_cost[b] is count * area over bins b+1 .. end
+        float right_cost[bvh_bin_count];
+        aabb right = empty_box();
+        int n = 0;
+        for (int b = nbins - 1; b > 0; b--) {
+            grow_box(right, aabb(vec3(bins.lo[k][b][0], bins.lo[k][b][1], bins.lo[k][b][2]),
+                                 vec3(bins.hi[k][b][0], bins.hi[k][b][1], bins.hi[k][b][2])));
+            n += bins.count[k][b];
+            right_cost[b - 1] = n > 0 ? n * right.area() : -1;
+        }
+        aabb left = empty_box();
+        n = 0;
+        for (int b = 0; b < nbins - 1; b++) {
+            grow_box(left, aabb(vec3(bins.lo[k][b][0], bins.lo[k][b][1], bins.lo[k][b][2]),
+                                vec3(bins.hi[k][b][0], bins.hi[k][b][1], bins.hi[k][b][2])));
+            n += bins.count[k][b];
+            if (n == 0 || right_cost[b] < 0)
+                continue;
+            float c = bvh_traversal_cost + bvh_intersection_cost * inv_area * (n * left.area() + right_cost[b]);
+            if (c < best_cost) {
+                best_cost = c;
+                best_axis = k;
+                best_bin = b;
+            }
+        }
+    }
+    if (best_axis < 0)
+        return false;
+
+    float axis_lo = lo[best_axis];
+    float axis_scale = scale[best_axis];
+    int last = nbins - 1;
+    auto goes_left = [=](const bvh_primitive& p) {
+        int b = int((p.centroid.e[best_axis] - axis_lo) * axis_scale);
+        if (b > last) b = last;
+        return b <= best_bin;
+    };
+    if (chunks == 1) {
+        mid = int(std::partition(prims, prims + count, goes_left) - prims);
+    }
+    else {
+        // partition each chunk in place, then gather the left and right parts
+        std::vector<int> left_count(chunks);
+        parallel_for(chunks, [&](int c) {
+            int begin = int((long long)count * c / chunks), end = int((long long)count * (c + 1) / chunks);
+            left_count[c] = int(std::partition(prims + begin, prims + end, goes_left) - (prims + begin));
+        }, chunks);
+        std::vector<int> left_at(chunks), right_at(chunks);
+        mid = 0;
+        for (int c = 0; c < chunks; c++) {
+            left_at[c] = mid;
+            mid += left_count[c];
+        }
+        int right = mid;
+        for (int c = 0; c < chunks; c++) {
+            int size = int((long long)count * (c + 1) / chunks) - int((long long)count * c / chunks);
+            right_at[c] = right;
+            right += size - left_count[c];
+        }
+        std::vector<bvh_primitive> gathered(count);
+        parallel_for(chunks, [&](int c) {
+            int begin = int((long long)count * c / chunks), end = int((long long)count * (c + 1) / chunks);
+            std::copy(prims + begin, prims + begin + left_count[c], gathered.begin() + left_at[c]);
+            std::copy(prims + begin + left_count[c], prims + end, gathered.begin() + right_at[c]);
+        }, chunks);
+        parallel_for(chunks, [&](int c) {
+            int begin = int((long long)count * c / chunks), end = int((long long)count * (c + 1) / chunks);
+            std::copy(gathered.begin() + begin, gathered.begin() + end, prims + begin);
+        }, chunks);
+    }
+    axis = best_axis;
+    cost = best_cost;
+    return true;
+}
+
+#endif
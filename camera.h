@@ -11,9 +11,12 @@
 // with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
 //==================================================================================================
 
+#include "packet.h"
 #include "random.h"
 #include "ray.h"
 
+#include <utility>
+
 
 vec3 random_in_unit_disk() {
     vec3 p;
@@ -50,6 +53,16 @@ class camera {
             return ray(origin + offset, lower_left_corner + s*horizontal + t*vertical - origin - offset, time);
         }
 
+        // Lanes 0..n-1 of p get get_ray(s[k], t[k]), each drawing its lens
+        // and time samples from rng[k] rather than the thread's sequence.
+        void get_packet(int n, const float *s, const float *t, pcg32 *rng, ray_packet& p) {
+            for (int k = 0; k < n; k++) {
+                std::swap(thread_rng(), rng[k]);
+                p.set(k, get_ray(s[k], t[k]));
+                std::swap(thread_rng(), rng[k]);
+            }
+        }
+
         vec3 origin;
         vec3 lower_left_corner;
         vec3 horizontal;
@@ -14,14 +14,17 @@
 #include "hittable.h"
 #include "random.h"
 #include <float.h>
+#include <utility>
 
 
 class constant_medium : public hittable  {
     public:
-        constant_medium(hittable *b, float d, texture *a) : boundary(b), density(d) { phase_function = new isotropic(a); }
+        constant_medium(hittable *b, float d, texture *a) : boundary(b), density(d) { phase_function = scene_new<isotropic>(a); }
         virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const { 
             return boundary->bounding_box(t0, t1, box); }
+        virtual void update_bounds(float time0, float time1) { boundary->update_bounds(time0, time1); }
         hittable *boundary;
         float density;
         material *phase_function;
@@ -59,4 +62,24 @@ bool constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& re
     return false;
 }
 
+// hit draws random numbers, so each lane draws from its own sequence.
+int constant_medium::hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+    int hits = 0;
+    for (int k = 0; k < packet_size; k++) {
+        if (!(lanes >> k & 1))
+            continue;
+        if (p.rng)
+            std::swap(thread_rng(), p.rng[k]);
+        hit_record temp;
+        if (hit(p.lane(k), t_min, t_max[k], temp)) {
+            rec[k] = temp;
+            t_max[k] = temp.t;
+            hits |= 1 << k;
+        }
+        if (p.rng)
+            std::swap(thread_rng(), p.rng[k]);
+    }
+    return hits;
+}
+
 #endif
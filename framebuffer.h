@@ -0,0 +1,29 @@
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+
+#include "vec3.h"
+
+#include <vector>
+
+
+// Linear radiance per pixel, and how many samples went into it. Rows are stored
+// top row first, which is the order the old pixel loops pushed them in (j from
+// ny-1 down to 0).
+class framebuffer {
+    public:
+        framebuffer() : nx(0), ny(0) {}
+        framebuffer(int w, int h) { resize(w, h); }
+        void resize(int w, int h) {
+            nx = w;
+            ny = h;
+            pixels.assign(size_t(nx) * ny, vec3(0, 0, 0));
+            sample_count.assign(size_t(nx) * ny, 0);
+        }
+        vec3& at(int i, int row) { return pixels[size_t(row) * nx + i]; }
+        const vec3& at(int i, int row) const { return pixels[size_t(row) * nx + i]; }
+        int nx, ny;
+        std::vector<vec3> pixels;
+        std::vector<int> sample_count;
+};
+
+#endif
@@ -12,12 +12,18 @@
 //==================================================================================================
 
 #include "aabb.h"
+#include "packet.h"
+#include "scene_arena.h"
 
 #include <float.h>
+#include <vector>
 
 
 class material;
 
+bool emits_light(const material *m);  // in material.h
+float emitted_luminance(const material *m, const vec3& p);
+
 void get_sphere_uv(const vec3& p, float& u, float& v) {
     float phi = atan2(p.z(), p.x());
     float theta = asin(p.y());
@@ -40,8 +46,35 @@ class hittable  {
     public:
         virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(float t0, float t1, aabb& box) const = 0;
+        // Intersects the rays of p in lanes, each against its own t_max[k].
+        // Lanes that hit get rec[k] and a lowered t_max[k] and are returned.
+        // Anything that can share work between rays overrides this.
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int hits = 0;
+            for (int k = 0; k < packet_size; k++) {
+                hit_record temp;
+                if ((lanes >> k & 1) && hit(p.lane(k), t_min, t_max[k], temp)) {
+                    rec[k] = temp;
+                    t_max[k] = temp.t;
+                    hits |= 1 << k;
+                }
+            }
+            return hits;
+        }
         virtual float  pdf_value(const vec3& o, const vec3& v) const  {return 0.0;}
         virtual vec3 random(const vec3& o) const {return vec3(1, 0, 0);}
+        // Appends the emissive primitives below this one, each wrapped so that
+        // its pdf_value and random work in world space.
+        virtual void collect_lights(std::vector<hittable*>& lights) {}
+        // Emitted luminance times area, used to decide how often a light is sampled.
+        virtual float light_power() const { return 0; }
+        // Called between frames once the primitives below have moved, so that
+        // bounding_box covers them over the new shutter interval. Anything
+        // with a BVH refits it here. Not safe to call while rendering.
+        virtual void update_bounds(float time0, float time1) {}
+        // Bytes held outside the object itself, such as a BVH's node array.
+        // Shapes shared with others, like an instance's, are not counted.
+        virtual size_t memory_bytes() const { return 0; }
 };
 
 class flip_normals : public hittable {
@@ -58,101 +91,25 @@ class flip_normals : public hittable {
         virtual bool bounding_box(float t0, float t1, aabb& box) const {
             return ptr->bounding_box(t0, t1, box);
         }
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int hits = ptr->hit_packet(p, lanes, t_min, t_max, rec);
+            for (int k = 0; k < packet_size; k++)
+                if (hits >> k & 1)
+                    rec[k].normal = -rec[k].normal;
+            return hits;
+        }
+        virtual float pdf_value(const vec3& o, const vec3& v) const { return ptr->pdf_value(o, v); }
+        virtual vec3 random(const vec3& o) const { return ptr->random(o); }
+        virtual float light_power() const { return ptr->light_power(); }
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            std::vector<hittable*> inner;
+            ptr->collect_lights(inner);
+            for (size_t i = 0; i < inner.size(); i++)
+                lights.push_back(scene_new<flip_normals>(inner[i]));
+        }
+        virtual void update_bounds(float time0, float time1) { ptr->update_bounds(time0, time1); }
         hittable *ptr;
 };
 
-class translate : public hittable {
-    public:
-        translate(hittable *p, const vec3& displacement) : ptr(p), offset(displacement) {}
-        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const;
-        hittable *ptr;
-        vec3 offset;
-};
-
-bool translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
-    if (ptr->hit(moved_r, t_min, t_max, rec)) {
-        rec.p += offset;
-        return true;
-    }
-    else
-        return false;
-}
-
-bool translate::bounding_box(float t0, float t1, aabb& box) const {
-    if (ptr->bounding_box(t0, t1, box)) {
-        box = aabb(box.min() + offset, box.max()+offset);
-        return true;
-    }
-    else
-        return false;
-}
-
-class rotate_y : public hittable {
-    public:
-        rotate_y(hittable *p, float angle);
-        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
-        virtual bool bounding_box(float t0, float t1, aabb& box) const {
-            box = bbox; return hasbox;}
-        hittable *ptr;
-        float sin_theta;
-        float cos_theta;
-        bool hasbox;
-        aabb bbox;
-};
-
-rotate_y::rotate_y(hittable *p, float angle) : ptr(p) {
-    float radians = (3.1416f / 180.) * angle;
-    sin_theta = sin(radians);
-    cos_theta = cos(radians);
-    hasbox = ptr->bounding_box(0, 1, bbox);
-    vec3 min(FLT_MAX, FLT_MAX, FLT_MAX);
-    vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++) {
-                float x = i*bbox.max().x() + (1-i)*bbox.min().x();
-                float y = j*bbox.max().y() + (1-j)*bbox.min().y();
-                float z = k*bbox.max().z() + (1-k)*bbox.min().z();
-                float newx = cos_theta*x + sin_theta*z;
-                float newz = -sin_theta*x + cos_theta*z;
-                vec3 tester(newx, y, newz);
-                for ( int c = 0; c < 3; c++ )
-                {
-                    if ( tester[c] > max[c] )
-                        max[c] = tester[c];
-                    if ( tester[c] < min[c] )
-                        min[c] = tester[c];
-                }
-            }
-        }
-    }
-    bbox = aabb(min, max);
-}
-
-bool rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
-    vec3 origin = r.origin();
-    vec3 direction = r.direction();
-    origin[0] = cos_theta*r.origin()[0] - sin_theta*r.origin()[2];
-    origin[2] =  sin_theta*r.origin()[0] + cos_theta*r.origin()[2];
-    direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
-    direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
-    ray rotated_r(origin, direction, r.time());
-    if (ptr->hit(rotated_r, t_min, t_max, rec)) {
-        vec3 p = rec.p;
-        vec3 normal = rec.normal;
-        p[0] = cos_theta*rec.p[0] + sin_theta*rec.p[2];
-        p[2] = -sin_theta*rec.p[0] + cos_theta*rec.p[2];
-        normal[0] = cos_theta*rec.normal[0] + sin_theta*rec.normal[2];
-        normal[2] = -sin_theta*rec.normal[0] + cos_theta*rec.normal[2];
-        rec.p = p;
-        rec.normal = normal;
-        return true;
-    }
-    else
-        return false;
-}
-
 #endif
 
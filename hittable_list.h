@@ -21,8 +21,22 @@ class hittable_list: public hittable  {
         hittable_list(hittable **l, int n) {list = l; list_size = n; }
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            int hits = 0;
+            for (int i = 0; i < list_size; i++)
+                hits |= list[i]->hit_packet(p, lanes, t_min, t_max, rec);
+            return hits;
+        }
         virtual float  pdf_value(const vec3& o, const vec3& v) const;
         virtual vec3 random(const vec3& o) const;
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            for (int i = 0; i < list_size; i++)
+                list[i]->collect_lights(lights);
+        }
+        virtual void update_bounds(float time0, float time1) {
+            for (int i = 0; i < list_size; i++)
+                list[i]->update_bounds(time0, time1);
+        }
 
         hittable **list;
         int list_size;
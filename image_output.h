@@ -0,0 +1,405 @@
+#ifndef IMAGEOUTPUTH
+#define IMAGEOUTPUTH
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <ctype.h>
+#include <math.h>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+// Image files written a row at a time. Rows are numbered top first, like the
+// framebuffer. PFM, EXR and PPM rows sit at fixed offsets, so they are written
+// as soon as they finish; PNG rows have to go out in order.
+
+inline bool seek_to(FILE *f, long long offset) {
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+// Same sqrt gamma as the old TGA output, but clamped so bright pixels saturate
+// instead of wrapping around.
+inline unsigned char gamma_byte(float x) {
+    if (!(x > 0))
+        return 0;
+    if (x >= 1)
+        return 255;
+    return (unsigned char)(255.99f * sqrtf(x));
+}
+
+class image_writer {
+    public:
+        image_writer() : file(0), nx(0), ny(0) {}
+        virtual ~image_writer() { if (file) fclose(file); }
+        virtual bool open(const char *filename, int w, int h) = 0;
+        virtual bool write_row(int row, const vec3 *pixels) = 0;
+        virtual bool close() {
+            bool ok = file && fclose(file) == 0;
+            file = 0;
+            return ok;
+        }
+        virtual bool in_order() const { return false; }
+    protected:
+        bool open_file(const char *filename, int w, int h) {
+            nx = w;
+            ny = h;
+            file = fopen(filename, "wb");
+            if (!file)
+                std::cerr << "could not open " << filename << "\n";
+            return file != 0;
+        }
+        FILE *file;
+        int nx, ny;
+};
+
+// Portable float map: little-endian RGB floats, bottom row first.
+class pfm_writer : public image_writer {
+    public:
+        virtual bool open(const char *filename, int w, int h) {
+            if (!open_file(filename, w, h))
+                return false;
+            data_start = fprintf(file, "PF\n%d %d\n-1.0\n", nx, ny);
+            return data_start > 0;
+        }
+        virtual bool write_row(int row, const vec3 *pixels) {
+            long long row_bytes = 12LL * nx;
+            if (!seek_to(file, data_start + (ny - 1 - row) * row_bytes))
+                return false;
+            return fwrite(pixels, 12, nx, file) == size_t(nx);
+        }
+    private:
+        long long data_start;
+};
+
+// Binary PPM with the 8-bit gamma conversion.
+class ppm_writer : public image_writer {
+    public:
+        virtual bool open(const char *filename, int w, int h) {
+            if (!open_file(filename, w, h))
+                return false;
+            data_start = fprintf(file, "P6\n%d %d\n255\n", nx, ny);
+            bytes.resize(3 * size_t(nx));
+            return data_start > 0;
+        }
+        virtual bool write_row(int row, const vec3 *pixels) {
+            for (int i = 0; i < nx; i++)
+                for (int c = 0; c < 3; c++)
+                    bytes[3*i + c] = gamma_byte(pixels[i][c]);
+            if (!seek_to(file, data_start + row * 3LL * nx))
+                return false;
+            return fwrite(&bytes[0], 1, bytes.size(), file) == bytes.size();
+        }
+    private:
+        long long data_start;
+        std::vector<unsigned char> bytes;
+};
+
+// Scanline OpenEXR, uncompressed 32-bit float B, G, R channels with one row per
+// chunk. Every chunk has the same size, so the offset table is known up front.
+class exr_writer : public image_writer {
+    public:
+        virtual bool open(const char *filename, int w, int h) {
+            if (!open_file(filename, w, h))
+                return false;
+            std::vector<unsigned char> header;
+            const unsigned char magic[8] = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+            header.insert(header.end(), magic, magic + 8);
+
+            attribute(header, "channels", "chlist", 3 * 18 + 1);
+            const char *names[3] = { "B", "G", "R" };
+            for (int c = 0; c < 3; c++) {
+                put_string(header, names[c]);
+                put_int(header, 2);   // FLOAT
+                put_int(header, 0);   // pLinear and reserved
+                put_int(header, 1);   // x sampling
+                put_int(header, 1);   // y sampling
+            }
+            header.push_back(0);
+            attribute(header, "compression", "compression", 1);
+            header.push_back(0);
+            attribute(header, "dataWindow", "box2i", 16);
+            put_box(header);
+            attribute(header, "displayWindow", "box2i", 16);
+            put_box(header);
+            attribute(header, "lineOrder", "lineOrder", 1);
+            header.push_back(0);
+            attribute(header, "pixelAspectRatio", "float", 4);
+            put_float(header, 1.0f);
+            attribute(header, "screenWindowCenter", "v2f", 8);
+            put_float(header, 0.0f);
+            put_float(header, 0.0f);
+            attribute(header, "screenWindowWidth", "float", 4);
+            put_float(header, 1.0f);
+            header.push_back(0);
+
+            chunk_bytes = 8 + 12LL * nx;
+            data_start = (long long)header.size() + 8LL * ny;
+            for (int y = 0; y < ny; y++) {
+                uint64_t offset = uint64_t(data_start + y * chunk_bytes);
+                for (int b = 0; b < 8; b++)
+                    header.push_back((unsigned char)(offset >> (8 * b)));
+            }
+            chunk.resize(2 + 3 * size_t(nx));
+            return fwrite(&header[0], 1, header.size(), file) == header.size();
+        }
+        virtual bool write_row(int row, const vec3 *pixels) {
+            int32_t head[2] = { row, int32_t(12 * nx) };
+            memcpy(&chunk[0], head, 8);
+            for (int c = 0; c < 3; c++)
+                for (int i = 0; i < nx; i++)
+                    chunk[2 + size_t(c) * nx + i] = pixels[i][2 - c];
+            if (!seek_to(file, data_start + row * chunk_bytes))
+                return false;
+            return fwrite(&chunk[0], 4, chunk.size(), file) == chunk.size();
+        }
+    private:
+        static void put_string(std::vector<unsigned char>& out, const char *s) {
+            out.insert(out.end(), s, s + strlen(s) + 1);
+        }
+        static void put_int(std::vector<unsigned char>& out, int32_t v) {
+            for (int b = 0; b < 4; b++)
+                out.push_back((unsigned char)(uint32_t(v) >> (8 * b)));
+        }
+        static void put_float(std::vector<unsigned char>& out, float v) {
+            int32_t bits;
+            memcpy(&bits, &v, 4);
+            put_int(out, bits);
+        }
+        static void attribute(std::vector<unsigned char>& out, const char *name, const char *type, int size) {
+            put_string(out, name);
+            put_string(out, type);
+            put_int(out, size);
+        }
+        void put_box(std::vector<unsigned char>& out) const {
+            put_int(out, 0);
+            put_int(out, 0);
+            put_int(out, nx - 1);
+            put_int(out, ny - 1);
+        }
+        long long data_start, chunk_bytes;
+        std::vector<float> chunk;  // y and size, then the B, G and R rows
+};
+
+struct crc32_table {
+    crc32_table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            entry[i] = c;
+        }
+    }
+    uint32_t entry[256];
+};
+
+inline uint32_t crc32_update(uint32_t crc, const unsigned char *data, size_t n) {
+    static const crc32_table table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++)
+        crc = table.entry[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// 8-bit RGB PNG. The zlib stream uses stored (uncompressed) deflate blocks, and
+// each row goes out as its own IDAT chunk, so nothing is held back but one row.
+class png_writer : public image_writer {
+    public:
+        virtual bool open(const char *filename, int w, int h) {
+            if (!open_file(filename, w, h))
+                return false;
+            const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+            fwrite(signature, 1, 8, file);
+            std::vector<unsigned char> ihdr;
+            put_be(ihdr, uint32_t(nx));
+            put_be(ihdr, uint32_t(ny));
+            const unsigned char format[5] = { 8, 2, 0, 0, 0 };  // 8 bits, RGB, no interlace
+            ihdr.insert(ihdr.end(), format, format + 5);
+            adler_a = 1;
+            adler_b = 0;
+            rows_written = 0;
+            return write_chunk("IHDR", ihdr);
+        }
+        virtual bool write_row(int row, const vec3 *pixels) {
+            std::vector<unsigned char> scanline(1 + 3 * size_t(nx));
+            scanline[0] = 0;  // no filter
+            for (int i = 0; i < nx; i++)
+                for (int c = 0; c < 3; c++)
+                    scanline[1 + 3*i + c] = gamma_byte(pixels[i][c]);
+            for (size_t i = 0; i < scanline.size(); i++) {
+                adler_a = (adler_a + scanline[i]) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+            data.clear();
+            if (row == 0) {
+                data.push_back(0x78);
+                data.push_back(0x01);
+            }
+            bool last_row = row == ny - 1;
+            for (size_t at = 0; at < scanline.size(); at += 65535) {
+                size_t len = scanline.size() - at < 65535 ? scanline.size() - at : 65535;
+                bool final_block = last_row && at + len == scanline.size();
+                data.push_back(final_block ? 1 : 0);
+                data.push_back((unsigned char)(len & 0xff));
+                data.push_back((unsigned char)(len >> 8));
+                data.push_back((unsigned char)(~len & 0xff));
+                data.push_back((unsigned char)((~len >> 8) & 0xff));
+                data.insert(data.end(), scanline.begin() + at, scanline.begin() + at + len);
+            }
+            if (last_row)
+                put_be(data, (adler_b << 16) | adler_a);
+            rows_written++;
+            return write_chunk("IDAT", data);
+        }
+        virtual bool close() {
+            bool ok = rows_written == ny && write_chunk("IEND", std::vector<unsigned char>());
+            return image_writer::close() && ok;
+        }
+        virtual bool in_order() const { return true; }
+    private:
+        static void put_be(std::vector<unsigned char>& out, uint32_t v) {
+            for (int b = 3; b >= 0; b--)
+                out.push_back((unsigned char)(v >> (8 * b)));
+        }
+        bool write_chunk(const char *type, const std::vector<unsigned char>& body) {
+            std::vector<unsigned char> head;
+            put_be(head, uint32_t(body.size()));
+            head.insert(head.end(), type, type + 4);
+            uint32_t crc = crc32_update(0, &head[4], 4);
+            if (!body.empty())
+                crc = crc32_update(crc, &body[0], body.size());
+            std::vector<unsigned char> tail;
+            put_be(tail, crc);
+            return fwrite(&head[0], 1, 8, file) == 8 &&
+                   (body.empty() || fwrite(&body[0], 1, body.size(), file) == body.size()) &&
+                   fwrite(&tail[0], 1, 4, file) == 4;
+        }
+        uint32_t adler_a, adler_b;
+        int rows_written;
+        std::vector<unsigned char> data;
+};
+
+// Picks a writer from the file extension: .exr, .pfm, .png or .ppm.
+image_writer *make_image_writer(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    std::string ext = dot ? dot + 1 : "";
+    for (size_t i = 0; i < ext.size(); i++)
+        ext[i] = char(tolower(ext[i]));
+    if (ext == "exr") return new exr_writer;
+    if (ext == "pfm") return new pfm_writer;
+    if (ext == "png") return new png_writer;
+    if (ext == "ppm") return new ppm_writer;
+    std::cerr << "unknown image format: " << filename << "\n";
+    return 0;
+}
+
+
+// Sends finished rows of a framebuffer to any number of files while the render
+// is running. rows_done may be called from several threads; rows for in-order
+// writers are held in the framebuffer until every row above them is done. A
+// writer that fails to open, or fails a write, gets no more rows, and finish
+// reports it.
+class image_output {
+    public:
+        image_output() : next_row(0) {}
+        ~image_output() {
+            for (size_t w = 0; w < writers.size(); w++)
+                delete writers[w];
+        }
+        void add(const char *filename) {
+            image_writer *w = make_image_writer(filename);
+            if (w) {
+                writers.push_back(w);
+                names.push_back(filename);
+            }
+        }
+        // False if any writer failed to open.
+        bool begin(int nx, int ny) {
+            failed.assign(writers.size(), 0);
+            for (size_t w = 0; w < writers.size(); w++)
+                failed[w] = !writers[w]->open(names[w].c_str(), nx, ny);
+            done.assign(ny, 0);
+            next_row = 0;
+            return std::find(failed.begin(), failed.end(), 1) == failed.end();
+        }
+        void rows_done(const framebuffer& fb, int row0, int row1) {
+            std::lock_guard<std::mutex> guard(lock);
+            for (int row = row0; row < row1; row++) {
+                done[row] = 1;
+                for (size_t w = 0; w < writers.size(); w++)
+                    if (!writers[w]->in_order())
+                        write_row(w, fb, row);
+            }
+            for (; next_row < fb.ny && done[next_row]; next_row++)
+                for (size_t w = 0; w < writers.size(); w++)
+                    if (writers[w]->in_order())
+                        write_row(w, fb, next_row);
+        }
+        bool finish() {
+            bool ok = true;
+            for (size_t w = 0; w < writers.size(); w++)
+                if (!writers[w]->close() || failed[w]) {
+                    std::cerr << "error writing " << names[w] << "\n";
+                    ok = false;
+                }
+            return ok;
+        }
+    private:
+        void write_row(size_t w, const framebuffer& fb, int row) {
+            if (!failed[w] && !writers[w]->write_row(row, &fb.pixels[size_t(row) * fb.nx]))
+                failed[w] = 1;
+        }
+        std::vector<image_writer*> writers;
+        std::vector<std::string> names;
+        std::vector<char> failed;
+        std::vector<char> done;
+        int next_row;
+        std::mutex lock;
+};
+
+// Writes a finished framebuffer to one file.
+bool save_image(const framebuffer& fb, const char *filename) {
+    image_output out;
+    out.add(filename);
+    if (!out.begin(fb.nx, fb.ny))
+        return false;
+    out.rows_done(fb, 0, fb.ny);
+    return out.finish();
+}
+
+// Writes fb's per-pixel sample counts as a heatmap, black for none through
+// red and yellow to white for the most samples taken by any pixel.
+bool save_sample_heatmap(const framebuffer& fb, const char *filename) {
+    image_writer *w = make_image_writer(filename);
+    if (!w)
+        return false;
+    bool ok = w->open(filename, fb.nx, fb.ny);
+    int most = 1;
+    for (size_t p = 0; p < fb.sample_count.size(); p++)
+        most = fb.sample_count[p] > most ? fb.sample_count[p] : most;
+    std::vector<vec3> row(fb.nx);
+    for (int r = 0; ok && r < fb.ny; r++) {
+        for (int i = 0; i < fb.nx; i++) {
+            float t = 3.0f * fb.sample_count[size_t(r) * fb.nx + i] / most;
+            row[i] = vec3(std::min(t, 1.0f), std::min(std::max(t - 1, 0.0f), 1.0f), std::max(t - 2, 0.0f));
+            row[i] *= row[i];  // undo the sqrt gamma of the 8-bit writers
+        }
+        ok = w->write_row(r, &row[0]);
+    }
+    ok = w->close() && ok;
+    delete w;
+    if (!ok)
+        std::cerr << "error writing " << filename << "\n";
+    return ok;
+}
+
+#endif
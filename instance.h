@@ -0,0 +1,102 @@
+#ifndef INSTANCEH
+#define INSTANCEH
+
+#include "hittable.h"
+#include "scene_arena.h"
+#include "transform.h"
+
+#include <vector>
+
+
+// One placement of a shared shape. The shape, usually something with its own
+// BVH (a linear_bvh, sphere_set or triangle_mesh), is built once in its own
+// space; any number of instances refer to it, each with a transform and
+// optionally a material that replaces the shape's own. Instances go into a
+// linear_bvh like any other hittable, which makes that the top level of a
+// two-level hierarchy, so memory grows with the unique shapes and only an
+// instance record per copy.
+//
+// Light sampling goes through the shape's own lights and assumes a rigid
+// transform, and an instance with an override material is never sampled as a
+// light.
+//
+// update_bounds only recomputes the instance's box from the shape's current
+// one: the shape is shared, so whoever animates it updates it once, before
+// the instances above it.
+class instance : public hittable {
+    public:
+        instance(hittable *shape, const transform& to_world, material *override_material = 0);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& b) const {
+            b = box;
+            return hasbox;
+        }
+        virtual float pdf_value(const vec3& o, const vec3& v) const {
+            return shape->pdf_value(to_object.point(o), to_object.vector(v));
+        }
+        virtual vec3 random(const vec3& o) const { return to_world.vector(shape->random(to_object.point(o))); }
+        virtual float light_power() const { return shape->light_power(); }
+        virtual void collect_lights(std::vector<hittable*>& lights);
+        virtual void update_bounds(float time0, float time1);
+
+        hittable *shape;
+        transform to_world;
+        transform to_object;
+        material *override_material;
+        aabb box;
+        bool hasbox;
+    private:
+        void to_world_space(hit_record& rec) const;
+};
+
+instance::instance(hittable *shape, const transform& to_world, material *override_material)
+    : shape(shape), to_world(to_world), to_object(to_world.inverse()), override_material(override_material) {
+    update_bounds(0, 1);
+}
+
+void instance::update_bounds(float time0, float time1) {
+    hasbox = shape->bounding_box(time0, time1, box);
+    if (hasbox)
+        box = to_world.box(box);
+}
+
+void instance::to_world_space(hit_record& rec) const {
+    rec.p = to_world.point(rec.p);
+    rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+    if (override_material)
+        rec.mat_ptr = override_material;
+}
+
+bool instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    // the direction is not renormalised, so t means the same in both spaces
+    ray local(to_object.point(r.origin()), to_object.vector(r.direction()), r.time());
+    if (!shape->hit(local, t_min, t_max, rec))
+        return false;
+    to_world_space(rec);
+    return true;
+}
+
+int instance::hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+    ray_packet local = p;
+    for (int k = 0; k < packet_size; k++)
+        if (lanes >> k & 1)
+            local.set(k, ray(to_object.point(vec3(p.ox[k], p.oy[k], p.oz[k])),
+                             to_object.vector(vec3(p.dx[k], p.dy[k], p.dz[k])), p.time[k]));
+    int hits = shape->hit_packet(local, lanes, t_min, t_max, rec);
+    for (int k = 0; k < packet_size; k++)
+        if (hits >> k & 1)
+            to_world_space(rec[k]);
+    return hits;
+}
+
+void instance::collect_lights(std::vector<hittable*>& lights) {
+    if (override_material)
+        return;
+    std::vector<hittable*> inner;
+    shape->collect_lights(inner);
+    for (size_t i = 0; i < inner.size(); i++)
+        lights.push_back(scene_new<instance>(inner[i], to_world));
+}
+
+#endif
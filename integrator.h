@@ -0,0 +1,187 @@
+#ifndef INTEGRATORH
+#define INTEGRATORH
+
+#include "camera.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "pdf.h"
+#include "random.h"
+
+#include <float.h>
+
+
+// Which of the three books' estimators trace_path evaluates.
+enum path_estimator {
+    estimator_InOneWeekend,       // sky background, scatter_InOneWeekend
+    estimator_TheNextWeekend,     // black background, emitters, scatter_InOneWeekend
+    estimator_TheRestOfYourLife   // emitters, pdf sampling and next-event estimation
+};
+
+int max_depth = 50;       // bounces, as in the old recursive color functions
+int roulette_depth = 3;   // bounces before Russian roulette may end a path
+bool packet_tracing = true;
+
+inline vec3 sky_color(const ray& r) {
+    vec3 unit_direction = unit_vector(r.direction());
+    float t = 0.5*(unit_direction.y() + 1.0);
+    return (1.0 - t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
+}
+
+inline vec3 de_nan(const vec3& c) {
+    vec3 temp = c;
+    if (!(temp[0] == temp[0])) temp[0] = 0;
+    if (!(temp[1] == temp[1])) temp[1] = 0;
+    if (!(temp[2] == temp[2])) temp[2] = 0;
+    return temp;
+}
+
+inline float power_heuristic(float pdf, float other_pdf) {
+    float a = pdf*pdf, b = other_pdf*other_pdf;
+    return a + b > 0 ? a / (a + b) : 0;
+}
+
+inline bool is_black(const vec3& c) {
+    return c[0] == 0 && c[1] == 0 && c[2] == 0;
+}
+
+// Follows one path as a loop, carrying the product of the scattering weights
+// so far in throughput. After roulette_depth bounces a path survives each
+// bounce with probability equal to its largest throughput channel (at most 1)
+// and is reweighted by 1/q, so the estimate is unbiased. If rays is given, the
+// number of rays cast into world is added to it.
+//
+// With estimator_TheRestOfYourLife and a non-empty light list, every diffuse
+// bounce also sends a shadow ray towards a sampled light. Light reached that way
+// and light found by the material's own sample are both kept, weighted against
+// each other with the power heuristic.
+//
+// continue_path is handed the camera ray's first hit, already found;
+// trace_path finds it first.
+vec3 continue_path(const ray& camera_ray, bool hit, hit_record hrec, hittable *world, const light_list *lights,
+                   path_estimator mode, long long *rays = 0) {
+    bool sample_lights = mode == estimator_TheRestOfYourLife && lights && !lights->empty();
+    vec3 radiance(0, 0, 0);
+    vec3 throughput(1, 1, 1);
+    ray r = camera_ray;
+    vec3 scatter_p;
+    float scatter_pdf = 0;  // pdf of the material sample that made r; 0 for camera and specular rays
+    for (int depth = 0; ; depth++) {
+        if (depth > 0) {
+            if (rays)
+                ++*rays;
+            hit = world->hit(r, 0.001, FLT_MAX, hrec);
+        }
+        if (!hit) {
+            if (mode == estimator_InOneWeekend)
+                radiance += throughput * sky_color(r);
+            break;
+        }
+        if (mode != estimator_InOneWeekend) {
+            vec3 emitted = hrec.mat_ptr->emitted(r, hrec, hrec.u, hrec.v, hrec.p);
+            if (sample_lights && scatter_pdf > 0 && !is_black(emitted))
+                emitted *= power_heuristic(scatter_pdf, lights->pdf_value(scatter_p, r.direction()));
+            radiance += throughput * emitted;
+        }
+        if (depth >= max_depth)
+            break;
+
+        ray scattered;
+        if (mode != estimator_TheRestOfYourLife) {
+            vec3 attenuation;
+            if (!hrec.mat_ptr->scatter_InOneWeekend(r, hrec, attenuation, scattered))
+                break;
+            throughput *= attenuation;
+        }
+        else {
+            scatter_record srec;
+            if (!hrec.mat_ptr->scatter(r, hrec, srec))
+                break;
+            if (srec.is_specular) {
+                scattered = srec.specular_ray;
+                throughput *= srec.attenuation;
+                scatter_pdf = 0;
+            }
+            else {
+                if (sample_lights) {
+                    ray shadow(hrec.p, lights->random(hrec.p), r.time());
+                    float light_pdf = lights->pdf_value(hrec.p, shadow.direction());
+                    float brdf = hrec.mat_ptr->scattering_pdf(r, hrec, shadow);
+                    if (light_pdf > 0 && brdf > 0) {
+                        hit_record lrec;
+                        if (rays)
+                            ++*rays;
+                        if (world->hit(shadow, 0.001, FLT_MAX, lrec)) {
+                            vec3 emitted = lrec.mat_ptr->emitted(shadow, lrec, lrec.u, lrec.v, lrec.p);
+                            float weight = power_heuristic(light_pdf, srec.sampling_pdf.value(shadow.direction()));
+                            radiance += throughput * srec.attenuation * emitted * (brdf * weight / light_pdf);
+                        }
+                    }
+                }
+                scattered = ray(hrec.p, srec.sampling_pdf.generate(), r.time());
+                float pdf_val = srec.sampling_pdf.value(scattered.direction());
+                throughput *= srec.attenuation * hrec.mat_ptr->scattering_pdf(r, hrec, scattered) / pdf_val;
+                scatter_p = hrec.p;
+                scatter_pdf = pdf_val;
+            }
+        }
+
+        if (depth + 1 >= roulette_depth) {
+            float q = ffmax(throughput.x(), ffmax(throughput.y(), throughput.z()));
+            if (q < 1) {
+                if (random_double() >= q)
+                    break;
+                throughput /= q;
+            }
+        }
+        r = scattered;
+    }
+    return radiance;
+}
+
+vec3 trace_path(const ray& camera_ray, hittable *world, const light_list *lights, path_estimator mode,
+                long long *rays = 0) {
+    hit_record hrec;
+    if (rays)
+        ++*rays;
+    bool hit = world->hit(camera_ray, 0.001, FLT_MAX, hrec);
+    return continue_path(camera_ray, hit, hrec, world, lights, mode, rays);
+}
+
+// Writes samples s0 .. s0+n-1 of pixel (i, j) of an nx x ny image to col,
+// j = 0 at the bottom and n at most packet_size. Each sample is seeded with
+// seed_sample. With packet_tracing the camera rays are cast as one packet and
+// each path then goes on alone from its first hit: after a diffuse bounce the
+// rays no longer travel together. Every lane keeps its own random sequence, so
+// the result is the same as tracing the samples one at a time.
+void trace_samples(camera& cam, int nx, int ny, int i, int j, int s0, int n, hittable *world,
+                   const light_list *lights, path_estimator mode, vec3 *col, long long *rays = 0) {
+    float s[packet_size], t[packet_size];
+    pcg32 rng[packet_size];
+    for (int k = 0; k < n; k++) {
+        seed_sample(i, j, s0 + k);
+        s[k] = float(i + random_double()) / float(nx);
+        t[k] = float(j + random_double()) / float(ny);
+        if (!packet_tracing)
+            col[k] = de_nan(trace_path(cam.get_ray(s[k], t[k]), world, lights, mode, rays));
+        rng[k] = thread_rng();
+    }
+    if (!packet_tracing)
+        return;
+    ray_packet p;
+    cam.get_packet(n, s, t, rng, p);
+    p.rng = rng;
+    float t_max[packet_size];
+    hit_record hrec[packet_size];
+    for (int k = 0; k < packet_size; k++)
+        t_max[k] = FLT_MAX;
+    int hits = world->hit_packet(p, (1 << n) - 1, 0.001, t_max, hrec);
+    if (rays)
+        *rays += n;
+    for (int k = 0; k < n; k++) {
+        thread_rng() = rng[k];
+        col[k] = de_nan(continue_path(p.lane(k), (hits >> k & 1) != 0, hrec[k], world, lights, mode, rays));
+    }
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef LIGHTSH
+#define LIGHTSH
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "random.h"
+
+#include <vector>
+
+
+// Every emissive primitive in a scene, found once when the scene is built and
+// kept in a BVH over their bounds. random walks down the tree from the root,
+// at each node picking a child in proportion to its light power over its
+// squared distance from o, and at the leaf picking a light by power.
+// pdf_value follows the ray o + t*v down the same tree, so it only asks the
+// lights the ray can reach, and multiplies the same choice probabilities.
+// Both take time proportional to the depth of the tree, not the light count.
+class light_list {
+    public:
+        light_list() {}
+        light_list(hittable *world);
+        bool empty() const { return lights.empty(); }
+        float pdf_value(const vec3& o, const vec3& v) const;
+        vec3 random(const vec3& o) const;
+
+        std::vector<hittable*> lights;  // in leaf slot order
+        std::vector<float> power;       // per light
+        std::vector<float> node_power;  // per tree node, the sum over its lights
+        bvh_tree tree;
+    private:
+        float importance(int node, const vec3& p) const;
+        float first_child_probability(int node, const vec3& p) const;
+        float slot_probability(const linear_bvh_node& leaf, int slot) const;
+};
+
+light_list::light_list(hittable *world) {
+    std::vector<hittable*> found;
+    world->collect_lights(found);
+    std::vector<bvh_primitive> prims(found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+        aabb box;
+        found[i]->bounding_box(0, 1, box);
+        prims[i] = make_bvh_primitive(box, int(i));
+    }
+    tree.build(prims);
+    lights.resize(tree.order.size());
+    power.resize(tree.order.size());
+    for (size_t slot = 0; slot < tree.order.size(); slot++) {
+        lights[slot] = found[tree.order[slot]];
+        power[slot] = ffmax(lights[slot]->light_power(), 0.0f);
+    }
+    // children always come after their parent, so a backwards pass sees them first
+    node_power.resize(tree.nodes.size());
+    for (int i = int(tree.nodes.size()) - 1; i >= 0; i--) {
+        const linear_bvh_node& n = tree.nodes[i];
+        if (n.count > 0) {
+            node_power[i] = 0;
+            for (int slot = n.offset; slot < n.offset + n.count; slot++)
+                node_power[i] += power[slot];
+        }
+        else
+            node_power[i] = node_power[i + 1] + node_power[n.offset];
+    }
+}
+
+// Power over squared distance to the node's box, treating points inside the
+// box's bounding sphere as being on it.
+float light_list::importance(int node, const vec3& p) const {
+    const linear_bvh_node& n = tree.nodes[node];
+    float d2 = 0, r2 = 0;
+    for (int a = 0; a < 3; a++) {
+        float half = 0.5f * (n.bmax[a] - n.bmin[a]);
+        float d = p[a] - (n.bmin[a] + half);
+        d2 += d*d;
+        r2 += half*half;
+    }
+    return node_power[node] / ffmax(ffmax(d2, r2), 1e-12f);
+}
+
+float light_list::first_child_probability(int node, const vec3& p) const {
+    float first = importance(node + 1, p);
+    float second = importance(tree.nodes[node].offset, p);
+    return first + second > 0 ? first / (first + second) : 0.5f;
+}
+
+float light_list::slot_probability(const linear_bvh_node& leaf, int slot) const {
+    float total = 0;
+    for (int s = leaf.offset; s < leaf.offset + leaf.count; s++)
+        total += power[s];
+    return total > 0 ? power[slot] / total : 1.0f / leaf.count;
+}
+
+vec3 light_list::random(const vec3& o) const {
+    int index = 0;
+    while (tree.nodes[index].count == 0) {
+        if (random_double() < first_child_probability(index, o))
+            index = index + 1;
+        else
+            index = tree.nodes[index].offset;
+    }
+    const linear_bvh_node& leaf = tree.nodes[index];
+    float u = random_double();
+    int slot = leaf.offset;
+    for (; slot < leaf.offset + leaf.count - 1; slot++) {
+        u -= slot_probability(leaf, slot);
+        if (u < 0)
+            break;
+    }
+    return lights[slot]->random(o);
+}
+
+float light_list::pdf_value(const vec3& o, const vec3& v) const {
+    if (lights.empty())
+        return 0;
+    vec3 inv(1.0f / v.x(), 1.0f / v.y(), 1.0f / v.z());
+    int stack[64];
+    float stack_prob[64];
+    int sp = 0;
+    int index = 0;
+    float prob = 1;
+    float sum = 0;
+    for (;;) {
+        const linear_bvh_node& n = tree.nodes[index];
+        float t0 = 0, t1 = FLT_MAX;
+        for (int a = 0; a < 3; a++) {
+            float ta = (n.bmin[a] - o[a]) * inv[a];
+            float tb = (n.bmax[a] - o[a]) * inv[a];
+            if (ta > tb) std::swap(ta, tb);
+            t0 = ta > t0 ? ta : t0;
+            t1 = tb < t1 ? tb : t1;
+        }
+        if (t0 <= t1 && prob > 0) {
+            if (n.count > 0) {
+                for (int slot = n.offset; slot < n.offset + n.count; slot++)
+                    sum += prob * slot_probability(n, slot) * lights[slot]->pdf_value(o, v);
+            }
+            else {
+                float first = first_child_probability(index, o);
+                stack[sp] = n.offset;
+                stack_prob[sp++] = prob * (1 - first);
+                index = index + 1;
+                prob *= first;
+                continue;
+            }
+        }
+        if (sp == 0)
+            break;
+        index = stack[--sp];
+        prob = stack_prob[sp];
+    }
+    return sum;
+}
+
+#endif
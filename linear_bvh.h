@@ -0,0 +1,855 @@
+#ifndef LINEARBVHH
+#define LINEARBVHH
+
+#include "bvh_build.h"
+#include "hittable.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+
+// 32 bytes, stored depth first. An interior node's first child follows it
+// directly and offset is the index of its second child; a leaf's offset is the
+// first of its count primitive slots.
+struct linear_bvh_node {
+    float bmin[3];
+    float bmax[3];
+    int offset;
+    unsigned short count;
+    unsigned short axis;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+// Total time spent in bvh_tree::build; trees may be built on several threads
+// at once.
+std::atomic<double> bvh_build_seconds(0);
+// Refitting keeps a tree's shape while its primitives move, which lets it
+// slowly get worse; once its SAH cost is this many times what it was when
+// built, the owner rebuilds it instead.
+float bvh_refit_limit = 1.5f;
+// Motion segments for a tree over moving primitives (see wide_bvh::fit_motion);
+// 0 bounds each one by its box over the whole shutter instead.
+int bvh_motion_segments = 1;
+
+// The acceleration structure on its own, so anything that can give bounds for
+// its primitives (hittables, mesh triangles) can be packed the same way.
+class bvh_tree {
+    public:
+        void build(std::vector<bvh_primitive>& prims);
+        template <typename F>
+        bool intersect(const ray& r, float t_min, float t_max, F hit_slot) const;
+        aabb bounds() const {
+            const linear_bvh_node& n = nodes[0];
+            return aabb(vec3(n.bmin[0], n.bmin[1], n.bmin[2]), vec3(n.bmax[0], n.bmax[1], n.bmax[2]));
+        }
+        float sah_cost() const;
+        int build_node(std::vector<bvh_primitive>& prims, int begin, int end, int workers);
+        int append(const bvh_tree& sub);
+
+        std::vector<linear_bvh_node> nodes;
+        std::vector<int> order;  // primitive index held in each leaf slot
+        int max_leaf_size = 4;
+        int leaf_batch = 1;  // slots a leaf intersects at once, costed as one primitive
+};
+
+// Subtrees larger than bvh_parallel_threshold are built as parallel tasks,
+// splitting the available workers between the two children.
+void bvh_tree::build(std::vector<bvh_primitive>& prims) {
+    nodes.clear();
+    order.clear();
+    if (prims.empty())
+        return;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    nodes.reserve(2 * prims.size());
+    order.reserve(prims.size());
+    build_node(prims, 0, int(prims.size()), worker_count());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double total = bvh_build_seconds;
+    while (!bvh_build_seconds.compare_exchange_weak(total, total + seconds))
+        ;
+}
+
+int bvh_tree::build_node(std::vector<bvh_primitive>& prims, int begin, int end, int workers) {
+    int index = int(nodes.size());
+    nodes.push_back(linear_bvh_node());
+    int count = end - begin;
+    aabb box, centroids;
+    bvh_bounds(&prims[begin], count, box, centroids, workers);
+    int mid = begin;
+    int axis = centroids.longest_axis();
+    float split_cost = FLT_MAX;
+    bool can_split = count > 1 &&
+        bvh_binned_split(&prims[begin], count, box, centroids, mid, axis, split_cost, workers);
+    mid += begin;
+    bool leaf;
+    if (can_split)
+        leaf = count <= max_leaf_size && (count + leaf_batch - 1) / leaf_batch * bvh_intersection_cost <= split_cost;
+    else {
+        // every centroid in one bin: no split separates them, so only cut big runs
+        leaf = count <= 255;
+        mid = begin + count / 2;
+    }
+    if (leaf) {
+        nodes[index].offset = int(order.size());
+        nodes[index].count = (unsigned short)count;
+        for (int i = begin; i < end; i++)
+            order.push_back(prims[i].index);
+    }
+    else if (workers > 1 && count >= bvh_parallel_threshold) {
+        bvh_tree right;
+        right.max_leaf_size = max_leaf_size;
+        right.leaf_batch = leaf_batch;
+        int left_workers = workers / 2;
+        std::thread task([&]() { right.build_node(prims, mid, end, workers - left_workers); });
+        build_node(prims, begin, mid, left_workers);
+        task.join();
+        int second = append(right);
+        nodes[index].offset = second;
+        nodes[index].count = 0;
+    }
+    else {
+        build_node(prims, begin, mid, 1);
+        int second = build_node(prims, mid, end, 1);
+        nodes[index].offset = second;
+        nodes[index].count = 0;
+    }
+    nodes[index].axis = (unsigned short)axis;
+    for (int a = 0; a < 3; a++) {
+        nodes[index].bmin[a] = box.min()[a];
+        nodes[index].bmax[a] = box.max()[a];
+    }
+    return index;
+}
+
+// Copies a subtree built on its own after the current nodes, keeping the
+// depth-first layout, and returns the index of its root.
+int bvh_tree::append(const bvh_tree& sub) {
+    int node_base = int(nodes.size());
+    int slot_base = int(order.size());
+    for (size_t i = 0; i < sub.nodes.size(); i++) {
+        linear_bvh_node n = sub.nodes[i];
+        n.offset += n.count > 0 ? slot_base : node_base;
+        nodes.push_back(n);
+    }
+    order.insert(order.end(), sub.order.begin(), sub.order.end());
+    return node_base;
+}
+
+// Expected cost of a random ray through the tree under the SAH cost model:
+// each node is weighted by its surface area relative to the root.
+float bvh_tree::sah_cost() const {
+    if (nodes.empty())
+        return 0;
+    float root_area = bounds().area();
+    if (!(root_area > 0))
+        return nodes[0].count * bvh_intersection_cost;
+    float cost = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const linear_bvh_node& n = nodes[i];
+        float dx = n.bmax[0] - n.bmin[0], dy = n.bmax[1] - n.bmin[1], dz = n.bmax[2] - n.bmin[2];
+        float area = 2*(dx*dy + dy*dz + dz*dx);
+        if (n.count > 0)
+            cost += area / root_area * n.count * bvh_intersection_cost;
+        else
+            cost += area / root_area * bvh_traversal_cost;
+    }
+    return cost;
+}
+
+// hit_slot(slot, t_max) intersects the primitive in a leaf slot and, on a hit,
+// lowers t_max to the hit distance and returns true. Nodes beyond the closest
+// hit so far are culled, and the child on the ray's side of the split is visited first.
+template <typename F>
+bool bvh_tree::intersect(const ray& r, float t_min, float t_max, F hit_slot) const {
+    if (nodes.empty())
+        return false;
+    ray_inv ri(r);
+    int stack[64];
+    int sp = 0;
+    int index = 0;
+    bool hit_anything = false;
+    for (;;) {
+        const linear_bvh_node& n = nodes[index];
+        float t0 = t_min, t1 = t_max;
+        for (int a = 0; a < 3; a++) {
+            float ta = (n.bmin[a] - ri.o[a]) * ri.inv[a];
+            float tb = (n.bmax[a] - ri.o[a]) * ri.inv[a];
+            if (ri.near[a]) std::swap(ta, tb);
+            t0 = ta > t0 ? ta : t0;
+            t1 = tb < t1 ? tb : t1;
+        }
+        if (t0 <= t1) {
+            if (n.count > 0) {
+                for (int slot = n.offset; slot < n.offset + n.count; slot++)
+                    if (hit_slot(slot, t_max))
+                        hit_anything = true;
+            }
+            else if (ri.near[n.axis]) {
+                stack[sp++] = index + 1;
+                index = n.offset;
+                continue;
+            }
+            else {
+                stack[sp++] = n.offset;
+                index = index + 1;
+                continue;
+            }
+        }
+        if (sp == 0)
+            break;
+        index = stack[--sp];
+    }
+    return hit_anything;
+}
+
+
+// The binary tree collapsed into one with up to W children per node, their
+// boxes side by side so one slab test covers them all. Each node takes the
+// place of a binary node and, while it has room, repeatedly opens its largest
+// interior child. Children are visited nearest first; leaves keep the
+// binary tree's slot ranges, so hit_slot works unchanged.
+#if defined(SIMD_AVX)
+const int bvh_width = 8;
+#else
+const int bvh_width = 4;
+#endif
+
+template <int W>
+struct wide_bvh_node {
+    box_lanes<W> box;
+    int child[W];  // node index, or first slot when count > 0
+    int count[W];  // primitives in a leaf child, 0 for an interior child or an empty lane
+};
+
+template <int W>
+class wide_bvh {
+    public:
+        void collapse(const bvh_tree& tree);
+        template <typename F>
+        bool intersect(const ray& r, float t_min, float t_max, F hit_slot) const {
+            return intersect_leaves(r, t_min, t_max, [&](int first, int count, float& closest) {
+                bool hit_anything = false;
+                for (int slot = first; slot < first + count; slot++)
+                    if (hit_slot(slot, closest))
+                        hit_anything = true;
+                return hit_anything;
+            });
+        }
+        template <typename F>
+        bool intersect_leaves(const ray& r, float t_min, float t_max, F hit_leaf) const;
+        template <typename F>
+        int intersect_packet(const ray_packet& p, int lanes, float t_min, float *t_max, F hit_slot) const;
+        aabb bounds() const { return root_box; }
+        aabb bounds(float t0, float t1) const;
+        template <typename F>
+        void refit(F slot_box);
+        template <typename F>
+        void fit_motion(int segments, float time0, float time1, F slot_box);
+        float sah_cost() const;
+        size_t memory_bytes() const {
+            return nodes.capacity() * sizeof(wide_bvh_node<W>) + key_boxes.capacity() * sizeof(box_lanes<W>)
+                + root_keys.capacity() * sizeof(aabb);
+        }
+
+        std::vector<wide_bvh_node<W> > nodes;
+        aabb root_box;
+        int root_count = 0;  // a tree that is a single leaf has no wide nodes
+        int root_offset = 0;
+        // motion keys, segments + 1 per node, node by node; none when segments is 0
+        std::vector<box_lanes<W> > key_boxes;
+        std::vector<aabb> root_keys;
+        int segments = 0;
+        float key_time0 = 0, key_scale = 0;
+    private:
+        int collapse_node(const bvh_tree& tree, int index);
+        template <typename F, typename B>
+        aabb fit(F slot_box, B node_box);
+        static aabb lane_union(const box_lanes<W>& b);
+        int segment_at(float time, float& s) const;
+        template <typename F>
+        int walk_packet(const ray_packet& p, int lanes, float t_min, float *t_max, F hit_slot,
+                        int seg, const float *s) const;
+};
+
+typedef wide_bvh<bvh_width> wide_tree;
+
+template <int W>
+void wide_bvh<W>::collapse(const bvh_tree& tree) {
+    nodes.clear();
+    key_boxes.clear();
+    root_keys.clear();
+    segments = 0;
+    root_count = 0;
+    if (tree.nodes.empty()) {
+        root_box = empty_box();
+        return;
+    }
+    root_box = tree.bounds();
+    if (tree.nodes[0].count > 0) {
+        root_count = tree.nodes[0].count;
+        root_offset = tree.nodes[0].offset;
+        return;
+    }
+    nodes.reserve(tree.nodes.size() / (W - 1) + 1);
+    collapse_node(tree, 0);
+}
+
+template <int W>
+int wide_bvh<W>::collapse_node(const bvh_tree& tree, int index) {
+    int children[W];
+    int n = 2;
+    children[0] = index + 1;
+    children[1] = tree.nodes[index].offset;
+    while (n < W) {
+        int open = -1;
+        float open_area = -1;
+        for (int k = 0; k < n; k++) {
+            const linear_bvh_node& c = tree.nodes[children[k]];
+            if (c.count > 0)
+                continue;
+            float dx = c.bmax[0] - c.bmin[0], dy = c.bmax[1] - c.bmin[1], dz = c.bmax[2] - c.bmin[2];
+            float area = dx*dy + dy*dz + dz*dx;
+            if (area > open_area) {
+                open = k;
+                open_area = area;
+            }
+        }
+        if (open < 0)
+            break;
+        int c = children[open];
+        children[open] = c + 1;
+        children[n++] = tree.nodes[c].offset;
+    }
+
+    int wide_index = int(nodes.size());
+    nodes.push_back(wide_bvh_node<W>());
+    clear_lanes(nodes[wide_index].box);
+    for (int k = 0; k < W; k++) {
+        nodes[wide_index].child[k] = 0;
+        nodes[wide_index].count[k] = 0;
+    }
+    for (int k = 0; k < n; k++) {
+        const linear_bvh_node& c = tree.nodes[children[k]];
+        int child = c.count > 0 ? c.offset : collapse_node(tree, children[k]);
+        wide_bvh_node<W>& node = nodes[wide_index];
+        for (int a = 0; a < 3; a++) {
+            node.box.bounds[0][a][k] = c.bmin[a];
+            node.box.bounds[1][a][k] = c.bmax[a];
+        }
+        node.child[k] = child;
+        node.count[k] = c.count;
+    }
+    return wide_index;
+}
+
+// Sets every node's boxes from slot_box(slot), the bounds of the primitive in
+// a leaf slot, and returns the root box. A node is only ever the child of a
+// shallower one, so the nodes are done a level at a time, deepest first, and
+// the nodes of a level in parallel. slot_box is called from several threads.
+// node_box(i) is where node i's boxes go: its own, or one of its motion keys.
+template <int W>
+template <typename F, typename B>
+aabb wide_bvh<W>::fit(F slot_box, B node_box) {
+    // an interior lane has count 0 and a child index above 0, the root's
+    int n = int(nodes.size());
+    std::vector<int> depth(n, 0);
+    int max_depth = 0;
+    for (int i = 0; i < n; i++)
+        for (int k = 0; k < W; k++)
+            if (nodes[i].count[k] == 0 && nodes[i].child[k] > 0) {
+                int d = depth[i] + 1;
+                depth[nodes[i].child[k]] = d;
+                max_depth = d > max_depth ? d : max_depth;
+            }
+    std::vector<int> level_start(max_depth + 2, 0), by_level(n);
+    for (int i = 0; i < n; i++)
+        level_start[depth[i] + 1]++;
+    for (int d = 0; d <= max_depth; d++)
+        level_start[d + 1] += level_start[d];
+    std::vector<int> next(level_start.begin(), level_start.end() - 1);
+    for (int i = 0; i < n; i++)
+        by_level[next[depth[i]]++] = i;
+
+    const int chunk = 256;
+    for (int d = max_depth; d >= 0; d--) {
+        int first = level_start[d], count = level_start[d + 1] - first;
+        parallel_for((count + chunk - 1) / chunk, [&](int c) {
+            int end = (c + 1) * chunk < count ? (c + 1) * chunk : count;
+            for (int j = c * chunk; j < end; j++) {
+                int i = by_level[first + j];
+                const wide_bvh_node<W>& node = nodes[i];
+                box_lanes<W>& box = node_box(i);
+                clear_lanes(box);
+                for (int k = 0; k < W; k++) {
+                    aabb b = empty_box();
+                    if (node.count[k] > 0) {
+                        for (int slot = node.child[k]; slot < node.child[k] + node.count[k]; slot++)
+                            grow_box(b, slot_box(slot));
+                    }
+                    else if (node.child[k] > 0)
+                        b = lane_union(node_box(node.child[k]));
+                    else
+                        continue;
+                    for (int a = 0; a < 3; a++) {
+                        box.bounds[0][a][k] = b.min()[a];
+                        box.bounds[1][a][k] = b.max()[a];
+                    }
+                }
+            }
+        });
+    }
+    return lane_union(node_box(0));
+}
+
+template <int W>
+aabb wide_bvh<W>::lane_union(const box_lanes<W>& b) {
+    aabb u = empty_box();
+    for (int k = 0; k < W; k++)
+        grow_box(u, aabb(vec3(b.bounds[0][0][k], b.bounds[0][1][k], b.bounds[0][2][k]),
+                         vec3(b.bounds[1][0][k], b.bounds[1][1][k], b.bounds[1][2][k])));
+    return u;
+}
+
+// Recomputes every box from slot_box(slot), keeping the shape of the tree.
+// Motion keys are left alone; refit them with fit_motion.
+template <int W>
+template <typename F>
+void wide_bvh<W>::refit(F slot_box) {
+    if (root_count > 0 || nodes.empty()) {
+        root_box = empty_box();
+        for (int slot = root_offset; slot < root_offset + root_count; slot++)
+            grow_box(root_box, slot_box(slot));
+        return;
+    }
+    root_box = fit(slot_box, [&](int i) -> box_lanes<W>& { return nodes[i].box; });
+}
+
+// Makes this a motion tree: every node also gets its boxes at segments + 1
+// evenly spaced times from time0 to time1, from slot_box(slot, time), the
+// bounds of a slot's primitive at an instant. A ray is tested against the
+// boxes of the segment its time falls in, interpolated to that time, which
+// bounds the primitives as long as each one's box moves linearly within a
+// segment (or bulges outwards, like the box of a turning shape). More segments
+// help when children cross over each other or motion is not linear. The
+// node's own boxes become the union of its keys, which is what sah_cost and
+// bounds() see. segments = 0 goes back to a static tree.
+template <int W>
+template <typename F>
+void wide_bvh<W>::fit_motion(int segments, float time0, float time1, F slot_box) {
+    key_boxes.clear();
+    root_keys.clear();
+    this->segments = 0;
+    if (segments <= 0 || root_count > 0 || nodes.empty() || !(time1 > time0))
+        return;
+    int keys = segments + 1;
+    key_boxes.resize(nodes.size() * keys);
+    root_keys.resize(keys);
+    for (int key = 0; key < keys; key++) {
+        float time = time0 + (time1 - time0) * key / segments;
+        root_keys[key] = fit([&](int slot) { return slot_box(slot, time); },
+                             [&](int i) -> box_lanes<W>& { return key_boxes[size_t(i) * keys + key]; });
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        box_lanes<W>& box = nodes[i].box;
+        box = key_boxes[i * keys];
+        for (int key = 1; key < keys; key++) {
+            const box_lanes<W>& k = key_boxes[i * keys + key];
+            for (int a = 0; a < 3; a++)
+                for (int lane = 0; lane < W; lane++) {
+                    box.bounds[0][a][lane] = ffmin(box.bounds[0][a][lane], k.bounds[0][a][lane]);
+                    box.bounds[1][a][lane] = ffmax(box.bounds[1][a][lane], k.bounds[1][a][lane]);
+                }
+        }
+    }
+    root_box = empty_box();
+    for (int key = 0; key < keys; key++)
+        grow_box(root_box, root_keys[key]);
+    this->segments = segments;
+    key_time0 = time0;
+    key_scale = segments / (time1 - time0);
+}
+
+// The motion segment time falls in, clamped to the keyed interval, and how far
+// along it.
+template <int W>
+inline int wide_bvh<W>::segment_at(float time, float& s) const {
+    float x = (time - key_time0) * key_scale;
+    x = x > 0 ? x : 0;  // also catches a NaN time
+    x = x < segments ? x : float(segments);
+    int seg = int(x);
+    seg = seg < segments ? seg : segments - 1;
+    s = x - seg;
+    return seg;
+}
+
+// The root box over [t0, t1]. A static tree's is the same at any time.
+template <int W>
+aabb wide_bvh<W>::bounds(float t0, float t1) const {
+    if (segments == 0)
+        return root_box;
+    aabb box = empty_box();
+    float times[2] = { t0, t1 };
+    for (int j = 0; j < 2; j++) {
+        float s;
+        int seg = segment_at(times[j], s);
+        const aabb& a = root_keys[seg];
+        const aabb& b = root_keys[seg + 1];
+        grow_box(box, aabb(a.min() + s * (b.min() - a.min()), a.max() + s * (b.max() - a.max())));
+    }
+    for (int key = 1; key < segments; key++) {
+        float time = key_time0 + key / key_scale;
+        if (time > t0 && time < t1)
+            grow_box(box, root_keys[key]);
+    }
+    return box;
+}
+
+// bvh_tree::sah_cost for the collapsed tree: every child box is weighted by its
+// area relative to the root's.
+template <int W>
+float wide_bvh<W>::sah_cost() const {
+    float root_area = root_box.area();
+    if (root_count > 0 || nodes.empty() || !(root_area > 0))
+        return root_count * bvh_intersection_cost;
+    float cost = bvh_traversal_cost;
+    for (size_t i = 0; i < nodes.size(); i++)
+        for (int k = 0; k < W; k++) {
+            const box_lanes<W>& b = nodes[i].box;
+            if (b.bounds[0][0][k] > b.bounds[1][0][k])
+                continue;  // empty lane
+            float dx = b.bounds[1][0][k] - b.bounds[0][0][k];
+            float dy = b.bounds[1][1][k] - b.bounds[0][1][k];
+            float dz = b.bounds[1][2][k] - b.bounds[0][2][k];
+            float area = 2*(dx*dy + dy*dz + dz*dx);
+            int count = nodes[i].count[k];
+            cost += area / root_area * (count > 0 ? count * bvh_intersection_cost : bvh_traversal_cost);
+        }
+    return cost;
+}
+
+// Same contract as bvh_tree::intersect, except that hit_leaf(first, count,
+// t_max) is handed a whole leaf, slots first .. first+count-1, so it can test
+// them together. Children the ray enters are sorted by entry distance and
+// pushed far to near; an entry is skipped when it is popped if the closest hit
+// so far is already nearer than it.
+template <int W>
+template <typename F>
+bool wide_bvh<W>::intersect_leaves(const ray& r, float t_min, float t_max, F hit_leaf) const {
+    bool hit_anything = false;
+    if (root_count > 0) {
+        if (root_box.hit(r, t_min, t_max))
+            hit_anything = hit_leaf(root_offset, root_count, t_max);
+        return hit_anything;
+    }
+    if (nodes.empty())
+        return false;
+    typedef typename simd_float<W>::type lanes;
+    struct entry {
+        float t;
+        int child;
+        int count;
+    };
+    ray_inv ri(r);
+    float s = 0;
+    int seg = segments > 0 ? segment_at(r.time(), s) : 0;
+    box_lanes<W> moved;
+    entry stack[64 * W];
+    int sp = 0;
+    stack[sp].t = t_min;
+    stack[sp].child = 0;
+    stack[sp++].count = 0;
+    float t_near[W];
+    while (sp > 0) {
+        entry e = stack[--sp];
+        if (e.t > t_max)
+            continue;
+        if (e.count > 0) {
+            if (hit_leaf(e.child, e.count, t_max))
+                hit_anything = true;
+            continue;
+        }
+        const wide_bvh_node<W>& node = nodes[e.child];
+        const box_lanes<W> *box = &node.box;
+        if (segments > 0) {
+            const box_lanes<W> *keys = &key_boxes[size_t(e.child) * (segments + 1) + seg];
+            lerp_lanes<lanes, W>(keys[0], keys[1], s, moved);
+            box = &moved;
+        }
+        int mask = slab_test<lanes, W>(*box, ri, t_min, t_max, t_near);
+        // insertion sort into stack[first, sp), farthest at the bottom
+        int first = sp;
+        for (int k = 0; k < W; k++) {
+            if (!(mask >> k & 1))
+                continue;
+            entry c;
+            c.t = t_near[k];
+            c.child = node.child[k];
+            c.count = node.count[k];
+            int s = sp++;
+            while (s > first && stack[s - 1].t < c.t) {
+                stack[s] = stack[s - 1];
+                s--;
+            }
+            stack[s] = c;
+        }
+    }
+    return hit_anything;
+}
+
+// One walk of the tree for every ray of p in lanes. Each child box of a node is
+// tested against all the rays still following the node at once, one ray per
+// vector lane, and pushed with the rays that enter it, ordered by the nearest
+// of those entries. A ray drops out of an entry once its closest hit is nearer
+// than the entry. hit_slot(slot, lanes) intersects a slot's primitive with
+// those rays, lowering t_max for the ones it hits, and returns them. In a
+// motion tree the rays of each motion segment walk it separately.
+template <int W>
+template <typename F>
+int wide_bvh<W>::intersect_packet(const ray_packet& p, int lanes, float t_min, float *t_max, F hit_slot) const {
+    int hits = 0;
+    if (root_count > 0) {
+        for (int slot = root_offset; slot < root_offset + root_count; slot++)
+            hits |= hit_slot(slot, lanes);
+        return hits;
+    }
+    if (nodes.empty())
+        return 0;
+    if (segments == 0)
+        return walk_packet(p, lanes, t_min, t_max, hit_slot, -1, 0);
+    int seg_lanes[packet_size];
+    float s[packet_size];
+    for (int k = 0; k < packet_size; k++)
+        seg_lanes[k] = segment_at(p.time[k], s[k]);
+    while (lanes) {
+        int first = 0;
+        while (!(lanes >> first & 1))
+            first++;
+        int seg = seg_lanes[first], group = 0;
+        for (int k = first; k < packet_size; k++)
+            if ((lanes >> k & 1) && seg_lanes[k] == seg)
+                group |= 1 << k;
+        hits |= walk_packet(p, group, t_min, t_max, hit_slot, seg, s);
+        lanes &= ~group;
+    }
+    return hits;
+}
+
+// intersect_packet for rays that are all in motion segment seg, s[k] of the way
+// along it, or seg = -1 for a static tree.
+template <int W>
+template <typename F>
+int wide_bvh<W>::walk_packet(const ray_packet& p, int lanes, float t_min, float *t_max, F hit_slot,
+                             int seg, const float *s) const {
+    int hits = 0;
+    typedef simd_float<packet_size>::type ray_lanes;
+    struct entry {
+        float t;
+        int child;
+        int count;
+        int lanes;
+    };
+    float inv[3][packet_size];
+    for (int k = 0; k < packet_size; k++) {
+        inv[0][k] = 1.0f / p.dx[k];
+        inv[1][k] = 1.0f / p.dy[k];
+        inv[2][k] = 1.0f / p.dz[k];
+    }
+    ray_lanes o[3] = { ray_lanes::load(p.ox), ray_lanes::load(p.oy), ray_lanes::load(p.oz) };
+    ray_lanes iv[3] = { ray_lanes::load(inv[0]), ray_lanes::load(inv[1]), ray_lanes::load(inv[2]) };
+    ray_lanes near_limit(t_min);
+    ray_lanes along = seg >= 0 ? ray_lanes::load(s) : ray_lanes(0.0f);
+    entry stack[64 * W];
+    int sp = 0;
+    stack[sp].t = t_min;
+    stack[sp].child = 0;
+    stack[sp].count = 0;
+    stack[sp++].lanes = lanes;
+    float t_near[packet_size];
+    while (sp > 0) {
+        entry e = stack[--sp];
+        int live = 0;
+        for (int k = 0; k < packet_size; k++)
+            if ((e.lanes >> k & 1) && e.t <= t_max[k])
+                live |= 1 << k;
+        if (!live)
+            continue;
+        if (e.count > 0) {
+            for (int slot = e.child; slot < e.child + e.count; slot++)
+                hits |= hit_slot(slot, live);
+            continue;
+        }
+        const wide_bvh_node<W>& node = nodes[e.child];
+        ray_lanes far_limit = ray_lanes::load(t_max);
+        int first = sp;
+        for (int c = 0; c < W; c++) {
+            if (node.box.bounds[0][0][c] > node.box.bounds[1][0][c])
+                continue;  // empty lane
+            ray_lanes t0 = near_limit, t1 = far_limit;
+            for (int a = 0; a < 3; a++) {
+                ray_lanes lo, hi;
+                if (seg < 0) {
+                    lo = ray_lanes(node.box.bounds[0][a][c]);
+                    hi = ray_lanes(node.box.bounds[1][a][c]);
+                }
+                else {
+                    const box_lanes<W> *keys = &key_boxes[size_t(e.child) * (segments + 1) + seg];
+                    float lo0 = keys[0].bounds[0][a][c], hi0 = keys[0].bounds[1][a][c];
+                    lo = ray_lanes(lo0) + along * ray_lanes(keys[1].bounds[0][a][c] - lo0);
+                    hi = ray_lanes(hi0) + along * ray_lanes(keys[1].bounds[1][a][c] - hi0);
+                }
+                lo = (lo - o[a]) * iv[a];
+                hi = (hi - o[a]) * iv[a];
+                t0 = max(min(lo, hi), t0);
+                t1 = min(max(lo, hi), t1);
+            }
+            int entering = le_mask(t0, t1) & live;
+            if (!entering)
+                continue;
+            t0.store(t_near);
+            entry n;
+            n.t = FLT_MAX;
+            for (int k = 0; k < packet_size; k++)
+                if (entering >> k & 1)
+                    n.t = ffmin(n.t, t_near[k]);
+            n.child = node.child[c];
+            n.count = node.count[c];
+            n.lanes = entering;
+            int s = sp++;
+            while (s > first && stack[s - 1].t < n.t) {
+                stack[s] = stack[s - 1];
+                s--;
+            }
+            stack[s] = n;
+        }
+    }
+    return hits;
+}
+
+
+class linear_bvh : public hittable {
+    public:
+        linear_bvh() {}
+        linear_bvh(hittable **l, int n, float time0, float time1) { build(l, n, time0, time1); }
+        void build(hittable **l, int n, float time0, float time1);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+            return wide.intersect_packet(p, lanes, t_min, t_max, [&](int slot, int live) {
+                return prims[slot]->hit_packet(p, live, t_min, t_max, rec);
+            });
+        }
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            for (size_t i = 0; i < prims.size(); i++)
+                prims[i]->collect_lights(lights);
+        }
+        virtual void update_bounds(float time0, float time1);
+        virtual size_t memory_bytes() const { return wide.memory_bytes() + prims.capacity() * sizeof(hittable*); }
+        wide_tree wide;
+        std::vector<hittable*> prims;  // in leaf slot order
+        float built_cost = 0;  // wide.sah_cost() right after the last build
+    private:
+        void fit_motion(bool moving, float time0, float time1);
+};
+
+// Whether h's box at time0 is not its box at time1.
+bool moves_between(hittable *h, float time0, float time1) {
+    aabb b0, b1;
+    if (!h->bounding_box(time0, time0, b0) || !h->bounding_box(time1, time1, b1))
+        return false;
+    for (int a = 0; a < 3; a++)
+        if (b0.min()[a] != b1.min()[a] || b0.max()[a] != b1.max()[a])
+            return true;
+    return false;
+}
+
+void linear_bvh::build(hittable **l, int n, float time0, float time1) {
+    std::vector<bvh_primitive> build_prims(n);
+    const int chunk = 1024;
+    std::vector<char> moving((n + chunk - 1) / chunk, 0);
+    parallel_for((n + chunk - 1) / chunk, [&](int c) {
+        int end = (c + 1) * chunk < n ? (c + 1) * chunk : n;
+        for (int i = c * chunk; i < end; i++) {
+            aabb box;
+            if (!l[i]->bounding_box(time0, time1, box))
+                std::cerr << "no bounding box in linear_bvh constructor\n";
+            // a motion tree is shaped by where things are halfway through
+            if (bvh_motion_segments > 0 && moves_between(l[i], time0, time1)) {
+                float mid = 0.5f * (time0 + time1);
+                l[i]->bounding_box(mid, mid, box);
+                moving[c] = 1;
+            }
+            build_prims[i] = make_bvh_primitive(box, i);
+        }
+    });
+    bvh_tree tree;
+    tree.build(build_prims);
+    wide.collapse(tree);
+    std::vector<hittable*> sorted(tree.order.size());
+    for (size_t slot = 0; slot < tree.order.size(); slot++)
+        sorted[slot] = l[tree.order[slot]];
+    prims.swap(sorted);
+    fit_motion(std::find(moving.begin(), moving.end(), 1) != moving.end(), time0, time1);
+    built_cost = wide.sah_cost();
+}
+
+void linear_bvh::fit_motion(bool moving, float time0, float time1) {
+    wide.fit_motion(moving ? bvh_motion_segments : 0, time0, time1, [&](int slot, float time) {
+        aabb box;
+        prims[slot]->bounding_box(time, time, box);
+        return box;
+    });
+}
+
+// Brings the tree up to date after the primitives have moved, for a new
+// shutter interval: the children first, then a refit of this tree from their
+// new boxes, or a full build if the refit has let its quality slip past
+// bvh_refit_limit. The children are updated one at a time, since one may
+// rebuild itself, which is parallel already; only gathering their boxes is
+// split over the workers.
+void linear_bvh::update_bounds(float time0, float time1) {
+    int n = int(prims.size());
+    for (int slot = 0; slot < n; slot++)
+        prims[slot]->update_bounds(time0, time1);
+    std::vector<aabb> boxes(n);
+    const int chunk = 1024;
+    std::vector<char> moving((n + chunk - 1) / chunk, 0);
+    parallel_for((n + chunk - 1) / chunk, [&](int c) {
+        int end = (c + 1) * chunk < n ? (c + 1) * chunk : n;
+        for (int slot = c * chunk; slot < end; slot++) {
+            if (!prims[slot]->bounding_box(time0, time1, boxes[slot]))
+                std::cerr << "no bounding box in linear_bvh::update_bounds\n";
+            if (bvh_motion_segments > 0 && !moving[c] && moves_between(prims[slot], time0, time1))
+                moving[c] = 1;
+        }
+    });
+    wide.refit([&](int slot) { return boxes[slot]; });
+    fit_motion(std::find(moving.begin(), moving.end(), 1) != moving.end(), time0, time1);
+    if (wide.sah_cost() > bvh_refit_limit * built_cost) {
+        std::vector<hittable*> l(prims);
+        build(l.data(), n, time0, time1);
+    }
+}
+
+bool linear_bvh::bounding_box(float t0, float t1, aabb& box) const {
+    if (prims.empty())
+        return false;
+    box = wide.bounds(t0, t1);
+    return true;
+}
+
+bool linear_bvh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    return wide.intersect(r, t_min, t_max, [&](int slot, float& closest) {
+        if (prims[slot]->hit(r, t_min, closest, rec)) {
+            closest = rec.t;
+            return true;
+        }
+        return false;
+    });
+}
+
+#endif
@@ -48,14 +48,14 @@ struct scatter_record
     ray specular_ray;
     bool is_specular;
     vec3 attenuation;
-    pdf *pdf_ptr;
+    variant_pdf sampling_pdf;
 };
 
 class material  {
     public:
-		texture *albedo;
-		vec3 color;
-		float fuzz;
+		texture *albedo = 0;
+		vec3 color = vec3(0, 0, 0);
+		float fuzz = 0;
 		bool hasTexture = false;
 
 		bool scatter_InOneWeekend(const ray& r_in, const hit_record& rec, vec3& attenuation, ray& scattered) const {
@@ -66,8 +66,8 @@ class material  {
 		}
 
 
-		virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
-			return false;
+		virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
+			return false;
 		}
         virtual float scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
             return 0;
@@ -75,6 +75,8 @@ class material  {
         virtual vec3 emitted(const ray& r_in, const hit_record& rec, float u, float v, const vec3& p) const {
             return vec3(0,0,0);
         }
+        virtual bool is_emissive() const { return false; }
+        virtual vec3 emission(const vec3& p) const { return vec3(0,0,0); }  // typical radiance near p
 
 
 };
@@ -85,7 +87,7 @@ class dielectric : public material {
 
         virtual bool scatter(const ray& r_in, const hit_record& hrec, scatter_record& srec) const {
             srec.is_specular = true;
-            srec.pdf_ptr = 0;
+            srec.sampling_pdf.clear();
             srec.attenuation = vec3(1.0, 1.0, 1.0);
             vec3 outward_normal;
              vec3 reflected = reflect(r_in.direction(), hrec.normal);
@@ -138,7 +140,7 @@ class metal : public material {
 			if (hasTexture) { srec.attenuation = albedo->value(hrec.u, hrec.v, hrec.p);}
 			else { srec.attenuation = color; }
             srec.is_specular = true;
-            srec.pdf_ptr = 0;
+            srec.sampling_pdf.clear();
             return true;
         }
 };
@@ -159,7 +161,7 @@ class lambertian : public material {
             srec.is_specular = false;
             if(hasTexture)srec.attenuation = albedo->value(hrec.u, hrec.v, hrec.p);
 			else { srec.attenuation = color; }
-            srec.pdf_ptr = new cosine_pdf(hrec.normal);
+            srec.sampling_pdf.set_cosine(hrec.normal);
             return true;
         }
 };
@@ -174,9 +176,22 @@ class diffuse_light : public material  {
             else
                 return vec3(0,0,0);
         }
+        virtual bool is_emissive() const { return true; }
+        virtual vec3 emission(const vec3& p) const { return emit->value(0.5, 0.5, p); }
         texture *emit;
 };
 
+bool emits_light(const material *m) {
+    return m && m->is_emissive();
+}
+
+float emitted_luminance(const material *m, const vec3& p) {
+    if (!emits_light(m))
+        return 0;
+    vec3 e = m->emission(p);
+    return 0.2126f*e[0] + 0.7152f*e[1] + 0.0722f*e[2];
+}
+
 
 
 class isotropic : public material {
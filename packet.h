@@ -0,0 +1,31 @@
+#ifndef PACKETH
+#define PACKETH
+
+#include "random.h"
+#include "ray.h"
+
+
+// packet_size rays side by side, one lane each, so code that treats them alike
+// can load a field of every lane at once. Which lanes are in use travels with
+// the packet as a bit mask, bit k for lane k. If rng is set, lane k's random
+// numbers come from rng[k], for anything that draws them while intersecting.
+const int packet_size = 8;
+const int packet_all_lanes = (1 << packet_size) - 1;
+
+struct ray_packet {
+    void set(int k, const ray& r) {
+        ox[k] = r.A[0]; oy[k] = r.A[1]; oz[k] = r.A[2];
+        dx[k] = r.B[0]; dy[k] = r.B[1]; dz[k] = r.B[2];
+        time[k] = r._time;
+    }
+    ray lane(int k) const {
+        return ray(vec3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k]), time[k]);
+    }
+
+    float ox[packet_size], oy[packet_size], oz[packet_size];
+    float dx[packet_size], dy[packet_size], dz[packet_size];
+    float time[packet_size];
+    pcg32 *rng = 0;
+};
+
+#endif
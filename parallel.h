@@ -0,0 +1,185 @@
+#ifndef PARALLELH
+#define PARALLELH
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+int render_threads = 0;  // 0 = one worker per hardware thread; set before the first parallel_for
+
+inline int worker_count() {
+    if (render_threads > 0)
+        return render_threads;
+    int n = int(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// worker_count() - 1 threads, started on first use and kept for the life of the
+// program, which help whoever calls run. A call may come from any thread,
+// including a pool thread inside another call's work, and it takes part in its
+// own work, so nested calls always make progress even when every pool thread
+// is busy.
+class worker_pool {
+    public:
+        worker_pool();
+        ~worker_pool();
+        // Calls work(w) once for each w in [0, nworkers): w = 0 on the calling
+        // thread, the rest on whichever pool threads are free before the caller
+        // finishes its own share. Indices nobody picked up by then are dropped,
+        // so work must be written to cope with that, as parallel_for's stealing
+        // is.
+        void run(int nworkers, const std::function<void(int)>& work);
+    private:
+        struct job {
+            const std::function<void(int)> *work;
+            int next, end;  // the worker indices still to hand out
+            int active;     // pool threads inside work
+        };
+        void serve();
+
+        std::mutex lock;
+        std::condition_variable wake, finished;
+        std::deque<job*> jobs;
+        std::vector<std::thread> threads;
+        bool stopping;
+};
+
+worker_pool::worker_pool() : stopping(false) {
+    for (int t = 1; t < worker_count(); t++)
+        threads.push_back(std::thread([this]() { serve(); }));
+}
+
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t t = 0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+void worker_pool::serve() {
+    std::unique_lock<std::mutex> hold(lock);
+    for (;;) {
+        wake.wait(hold, [this]() { return stopping || !jobs.empty(); });
+        if (stopping)
+            return;
+        job *j = jobs.front();
+        int w = j->next++;
+        if (j->next == j->end)
+            jobs.pop_front();
+        j->active++;
+        hold.unlock();
+        (*j->work)(w);
+        hold.lock();
+        if (--j->active == 0)
+            finished.notify_all();
+    }
+}
+
+void worker_pool::run(int nworkers, const std::function<void(int)>& work) {
+    job j;
+    j.work = &work;
+    j.next = 1;
+    j.end = nworkers;
+    j.active = 0;
+    if (nworkers > 1) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            jobs.push_back(&j);
+        }
+        wake.notify_all();
+    }
+    work(0);
+    if (nworkers <= 1)
+        return;
+    std::unique_lock<std::mutex> hold(lock);
+    if (j.next < j.end)
+        jobs.erase(std::find(jobs.begin(), jobs.end(), &j));
+    finished.wait(hold, [&]() { return j.active == 0; });
+}
+
+inline worker_pool& shared_worker_pool() {
+    static worker_pool pool;
+    return pool;
+}
+
+// Each worker owns a contiguous range of items and takes them from the front.
+// A worker whose range runs dry steals the back half of the fullest other range.
+struct work_range {
+    std::mutex lock;
+    int begin;
+    int end;
+};
+
+// Calls fn(i) for i in [0, count) on up to nworkers threads (0 = worker_count())
+// of the shared pool. A worker the pool had no thread free for leaves its range
+// to be stolen by the others.
+template <typename F>
+void parallel_for(int count, F fn, int nworkers = 0) {
+    if (nworkers <= 0)
+        nworkers = worker_count();
+    if (nworkers > count)
+        nworkers = count;
+    if (nworkers <= 1) {
+        for (int i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+    std::vector<work_range> ranges(nworkers);
+    for (int w = 0; w < nworkers; w++) {
+        ranges[w].begin = int((long long)count * w / nworkers);
+        ranges[w].end = int((long long)count * (w + 1) / nworkers);
+    }
+    auto worker = [&](int w) {
+        for (;;) {
+            int item = -1;
+            {
+                std::lock_guard<std::mutex> guard(ranges[w].lock);
+                if (ranges[w].begin < ranges[w].end)
+                    item = ranges[w].begin++;
+            }
+            if (item < 0) {
+                int victim = -1;
+                int most = 0;
+                for (int v = 0; v < nworkers; v++) {
+                    if (v == w) continue;
+                    std::lock_guard<std::mutex> guard(ranges[v].lock);
+                    int left = ranges[v].end - ranges[v].begin;
+                    if (left > most) {
+                        most = left;
+                        victim = v;
+                    }
+                }
+                if (victim < 0)
+                    return;
+                int stolen_begin, stolen_end;
+                {
+                    std::lock_guard<std::mutex> guard(ranges[victim].lock);
+                    int left = ranges[victim].end - ranges[victim].begin;
+                    if (left <= 0)
+                        continue;
+                    stolen_end = ranges[victim].end;
+                    stolen_begin = stolen_end - (left + 1) / 2;
+                    ranges[victim].end = stolen_begin;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(ranges[w].lock);
+                    ranges[w].begin = stolen_begin + 1;
+                    ranges[w].end = stolen_end;
+                }
+                item = stolen_begin;
+            }
+            fn(item);
+        }
+    };
+    shared_worker_pool().run(nworkers, worker);
+}
+
+#endif
@@ -56,6 +56,7 @@ class pdf  {
 
 class cosine_pdf : public pdf {
     public:
+        cosine_pdf() {}
         cosine_pdf(const vec3& w) { uvw.build_from_w(w); }
         virtual float value(const vec3& direction) const {
             float cosine = dot(unit_vector(direction), uvw.w());
@@ -72,7 +73,8 @@ class cosine_pdf : public pdf {
 
 class hittable_pdf : public pdf {
     public:
-        hittable_pdf(hittable *p, const vec3& origin) : ptr(p), o(origin) {}
+        hittable_pdf() {}
+        hittable_pdf(hittable *p, const vec3& origin) : o(origin), ptr(p) {}
         virtual float value(const vec3& direction) const {
             return ptr->pdf_value(o, direction);
         }
@@ -98,4 +100,40 @@ class mixture_pdf : public pdf {
         pdf *p[2];
 };
 
+// A cosine or hittable pdf held by value, so a material can hand one back in
+// its scatter_record without allocating. kind says which member is live; the
+// calls below are not virtual, so the compiler can inline them.
+class variant_pdf : public pdf {
+    public:
+        enum pdf_kind { no_pdf, cosine, hittable_shape };
+        variant_pdf() : kind(no_pdf) {}
+        void clear() { kind = no_pdf; }
+        void set_cosine(const vec3& w) {
+            kind = cosine;
+            cos_pdf.uvw.build_from_w(w);
+        }
+        void set_hittable(hittable *p, const vec3& origin) {
+            kind = hittable_shape;
+            shape_pdf.ptr = p;
+            shape_pdf.o = origin;
+        }
+        virtual float value(const vec3& direction) const {
+            if (kind == cosine)
+                return cos_pdf.cosine_pdf::value(direction);
+            if (kind == hittable_shape)
+                return shape_pdf.hittable_pdf::value(direction);
+            return 0;
+        }
+        virtual vec3 generate() const {
+            if (kind == cosine)
+                return cos_pdf.cosine_pdf::generate();
+            if (kind == hittable_shape)
+                return shape_pdf.hittable_pdf::generate();
+            return vec3(1, 0, 0);
+        }
+        pdf_kind kind;
+        cosine_pdf cos_pdf;
+        hittable_pdf shape_pdf;
+};
+
 #endif
@@ -0,0 +1,181 @@
+#ifndef PROGRESSIVEH
+#define PROGRESSIVEH
+
+#include "framebuffer.h"
+#include "image_output.h"
+#include "random.h"
+#include "render.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+
+
+// Progressive rendering: every pixel gets pass_spp more samples per pass, added
+// to a running sum, so the image is usable after each pass. Sample s of a pixel
+// is always seeded by seed_sample(i, j, s), so the sums alone are enough to
+// pick a render up where it stopped, and the finished image is the same as a
+// single uninterrupted render. Adaptive sampling does not apply here.
+bool progressive = false;
+int pass_spp = 4;
+const char *checkpoint_file = "render.checkpoint";
+double checkpoint_seconds = 300;  // 0 = after every pass
+const char *preview_file = "preview.png";
+double preview_seconds = 60;      // negative = no previews
+
+// nx, ny, render_seed, samples per pixel so far and in all, and a fingerprint
+// of the scene and camera, then the summed radiance and sample count of every
+// pixel.
+struct checkpoint_header {
+    char magic[4];
+    int32_t version;
+    int32_t nx, ny;
+    uint64_t seed;
+    int32_t samples_done;
+    int32_t samples_target;
+    uint64_t fingerprint;
+};
+
+const int32_t checkpoint_version = 2;
+
+// Folds the bytes of value into a checkpoint fingerprint.
+template <typename T>
+uint64_t add_fingerprint(uint64_t h, const T& value) {
+    unsigned char bytes[sizeof(T)];
+    memcpy(bytes, &value, sizeof(T));
+    for (size_t i = 0; i < sizeof(T); i++)
+        h = mix_bits(h ^ bytes[i]);
+    return h;
+}
+
+// Written to a temporary file first and then renamed over the old checkpoint,
+// so a crash while saving leaves the previous one intact.
+bool save_checkpoint(const char *filename, const framebuffer& sum, int samples_done, int ns, uint64_t fingerprint) {
+    std::string temp = std::string(filename) + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        std::cerr << "could not open " << temp << "\n";
+        return false;
+    }
+    checkpoint_header h;
+    memcpy(h.magic, "RTCK", 4);
+    h.version = checkpoint_version;
+    h.nx = sum.nx;
+    h.ny = sum.ny;
+    h.seed = render_seed;
+    h.samples_done = samples_done;
+    h.samples_target = ns;
+    h.fingerprint = fingerprint;
+    size_t n = sum.pixels.size();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(&sum.pixels[0], sizeof(vec3), n, f) == n &&
+              fwrite(&sum.sample_count[0], sizeof(int), n, f) == n;
+    ok = fclose(f) == 0 && ok;
+    if (ok) {
+        remove(filename);  // rename does not replace files on Windows
+        ok = rename(temp.c_str(), filename) == 0;
+    }
+    if (!ok)
+        std::cerr << "error writing checkpoint " << filename << "\n";
+    return ok;
+}
+
+// Restores sum and samples_done from filename if it holds a checkpoint of the
+// same size, seed, sample count and fingerprint.
+bool load_checkpoint(const char *filename, framebuffer& sum, int& samples_done, int ns, uint64_t fingerprint) {
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return false;
+    checkpoint_header h;
+    bool ok = fread(&h, sizeof(h), 1, f) == 1 && memcmp(h.magic, "RTCK", 4) == 0;
+    if (ok && h.version != checkpoint_version) {
+        std::cerr << "ignoring checkpoint " << filename << " from another version\n";
+        ok = false;
+    }
+    if (ok && (h.nx != sum.nx || h.ny != sum.ny || h.seed != render_seed || h.samples_target != ns ||
+               h.fingerprint != fingerprint)) {
+        std::cerr << "ignoring checkpoint " << filename << " from a different render\n";
+        ok = false;
+    }
+    size_t n = sum.pixels.size();
+    ok = ok && fread(&sum.pixels[0], sizeof(vec3), n, f) == n &&
+         fread(&sum.sample_count[0], sizeof(int), n, f) == n;
+    fclose(f);
+    if (ok)
+        samples_done = h.samples_done;
+    else
+        sum.resize(sum.nx, sum.ny);
+    return ok;
+}
+
+// fingerprint tells this render's checkpoints from those of other scenes and
+// cameras; render_camera makes one from its arguments.
+template <typename F>
+void render_progressive(framebuffer& fb, int ns, F sample, image_output *out, uint64_t fingerprint) {
+    framebuffer sum(fb.nx, fb.ny);
+    int samples_done = 0;
+    if (load_checkpoint(checkpoint_file, sum, samples_done, ns, fingerprint)) {
+        if (samples_done < ns)
+            std::cout << "resuming from " << checkpoint_file << " at " << samples_done << " samples\n";
+        else {
+            sum.resize(fb.nx, fb.ny);
+            samples_done = 0;
+        }
+    }
+    typedef std::chrono::steady_clock clock;
+    clock::time_point last_checkpoint = clock::now(), last_preview = clock::now();
+    while (samples_done < ns) {
+        int first = samples_done;
+        int last = first + pass_spp < ns ? first + pass_spp : ns;
+        render_tiles(fb, [&](int i, int j) {
+            int row = fb.ny - 1 - j;
+            vec3& acc = sum.at(i, row);
+            for (int s = first; s < last; s += packet_size) {
+                int n = last - s < packet_size ? last - s : packet_size;
+                vec3 cols[packet_size];
+                sample(i, j, s, n, cols);
+                for (int k = 0; k < n; k++)
+                    acc += cols[k];
+            }
+            int& count = sum.sample_count[size_t(row) * fb.nx + i];
+            count += last - first;
+            fb.sample_count[size_t(row) * fb.nx + i] = count;
+            return acc / float(count);
+        }, last == ns ? out : 0);
+        samples_done = last;
+        clock::time_point now = clock::now();
+        if (samples_done < ns && std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_seconds) {
+            save_checkpoint(checkpoint_file, sum, samples_done, ns, fingerprint);
+            last_checkpoint = now;
+        }
+        if (samples_done < ns && preview_seconds >= 0 &&
+            std::chrono::duration<double>(now - last_preview).count() >= preview_seconds) {
+            save_image(fb, preview_file);
+            last_preview = now;
+        }
+    }
+    remove(checkpoint_file);
+}
+
+// Renders ns samples of every pixel into fb and streams it to out.
+// sample(i, j, s0, n, col) writes samples s0 .. s0+n-1 of pixel (i, j), j = 0 at
+// the bottom, to col; n is at most packet_size, and sample s must be seeded with
+// seed_sample(i, j, s), as trace_samples does. fingerprint identifies the
+// scene and camera for progressive checkpoints.
+template <typename F>
+void render_image(framebuffer& fb, int ns, F sample, image_output *out, uint64_t fingerprint = 0) {
+    if (progressive) {
+        render_progressive(fb, ns, sample, out, fingerprint);
+        return;
+    }
+    render_tiles(fb, [&](int i, int j) {
+        return sample_pixel(fb, i, j, ns, [&](int s0, int n, vec3 *col) {
+            sample(i, j, s0, n, col);
+        });
+    }, out);
+}
+
+#endif
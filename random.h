@@ -1,11 +1,65 @@
 #ifndef RANDOMH
 #define RANDOMH
 
-#include <cstdlib>
+#include <stdint.h>
 #include "vec3.h"
 
+
+// PCG32 (O'Neill, pcg-random.org): 64 bits of state, 32-bit output, and a
+// selectable stream so different samples never share a sequence.
+class pcg32 {
+    public:
+        pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+        pcg32(uint64_t s, uint64_t stream) { seed(s, stream); }
+        void seed(uint64_t s, uint64_t stream) {
+            state = 0;
+            inc = (stream << 1) | 1;
+            next();
+            state += s;
+            next();
+        }
+        uint32_t next() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ULL + inc;
+            uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+            uint32_t rot = uint32_t(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+        uint64_t state;
+        uint64_t inc;
+};
+
+uint64_t render_seed = 0;
+
+// splitmix64 finalizer, used to spread pixel coordinates over the seed space
+inline uint64_t mix_bits(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+inline pcg32& thread_rng() {
+    static thread_local pcg32 rng;
+    return rng;
+}
+
+inline void seed_random(uint64_t seed) {
+    thread_rng().seed(mix_bits(seed), 0);
+}
+
+// Restarts the calling thread's generator at a point that depends only on
+// render_seed, the pixel and the sample number, so a pixel renders the same
+// on any thread and can be re-rendered alone when debugging.
+inline void seed_sample(int i, int j, int s) {
+    uint64_t pixel = (uint64_t(uint32_t(j)) << 32) | uint32_t(i);
+    thread_rng().seed(mix_bits(render_seed ^ mix_bits(pixel)), uint64_t(s) + 1);
+}
+
 inline double random_double() {
-    return rand() / (RAND_MAX + 1.0);
+    return thread_rng().next() * (1.0 / 4294967296.0);
 }
 
 
@@ -0,0 +1,115 @@
+#ifndef RENDERH
+#define RENDERH
+
+#include "framebuffer.h"
+#include "image_output.h"
+#include "packet.h"
+#include "parallel.h"
+
+#include <iostream>
+#include <math.h>
+#include <mutex>
+#include <vector>
+
+
+int tile_size = 16;
+
+// Adaptive sampling: a pixel stops taking samples once the standard error of
+// its mean luminance is below adaptive_error times that mean, checked every
+// adaptive_batch samples from adaptive_min_spp up to adaptive_max_spp. When it
+// is off every pixel takes exactly the ns samples its driver asks for.
+bool adaptive_sampling = false;
+int adaptive_min_spp = 16;
+int adaptive_max_spp = 1024;
+int adaptive_batch = 8;
+float adaptive_error = 0.05f;
+
+// Averages the samples of pixel (i, j), j = 0 at the bottom, and records their
+// number in fb. sample(s0, n, col) writes samples s0 .. s0+n-1 to col, n at most
+// packet_size. The mean and variance are tracked with Welford's update, so
+// nothing is stored per sample.
+template <typename F>
+vec3 sample_pixel(framebuffer& fb, int i, int j, int ns, F sample) {
+    int max_spp = adaptive_sampling ? adaptive_max_spp : ns;
+    vec3 sum(0, 0, 0);
+    double mean = 0, m2 = 0;
+    int n = 0;
+    while (n < max_spp) {
+        int block = max_spp - n < packet_size ? max_spp - n : packet_size;
+        if (adaptive_sampling) {
+            // stop each block at the next convergence check
+            int first_check = adaptive_min_spp > n + 1 ? adaptive_min_spp : n + 1;
+            int check = (first_check + adaptive_batch - 1) / adaptive_batch * adaptive_batch;
+            if (check - n < block)
+                block = check - n;
+        }
+        vec3 cols[packet_size];
+        sample(n, block, cols);
+        for (int k = 0; k < block; k++) {
+            vec3 col = cols[k];
+            sum += col;
+            n++;
+            double y = 0.2126*col[0] + 0.7152*col[1] + 0.0722*col[2];
+            double delta = y - mean;
+            mean += delta / n;
+            m2 += delta * (y - mean);
+        }
+        if (adaptive_sampling && n >= adaptive_min_spp && n % adaptive_batch == 0) {
+            double standard_error = sqrt(m2 / (n - 1) / n);
+            // the small floor keeps black pixels from sampling forever
+            if (standard_error <= adaptive_error * (mean + 1e-3))
+                break;
+        }
+    }
+    fb.sample_count[size_t(fb.ny - 1 - j) * fb.nx + i] = n;
+    return n > 0 ? sum / float(n) : sum;
+}
+
+// Cuts the frame into tile_size x tile_size tiles and hands them to the worker
+// pool. shade_tile(x0, x1, row0, row1) fills in the pixels of one tile, rows
+// counted from the top; tiles finish in any order. If out is given, each band of
+// tile rows is passed to it as soon as its last tile is done, so the image is
+// on disk when the render returns.
+template <typename F>
+void for_each_tile(framebuffer& fb, F shade_tile, image_output *out = 0) {
+    int tiles_x = (fb.nx + tile_size - 1) / tile_size;
+    int tiles_y = (fb.ny + tile_size - 1) / tile_size;
+    std::vector<int> band_left(tiles_y, tiles_x);
+    std::mutex band_lock;
+    // the files that did open are still written; finish reports the rest
+    if (out && !out->begin(fb.nx, fb.ny))
+        std::cerr << "rendering without the image files that could not be opened\n";
+    parallel_for(tiles_x * tiles_y, [&](int t) {
+        int x0 = (t % tiles_x) * tile_size;
+        int row0 = (t / tiles_x) * tile_size;
+        int x1 = x0 + tile_size < fb.nx ? x0 + tile_size : fb.nx;
+        int row1 = row0 + tile_size < fb.ny ? row0 + tile_size : fb.ny;
+        shade_tile(x0, x1, row0, row1);
+        if (out) {
+            bool band_done;
+            {
+                std::lock_guard<std::mutex> guard(band_lock);
+                band_done = --band_left[t / tiles_x] == 0;
+            }
+            if (band_done)
+                out->rows_done(fb, row0, row1);
+        }
+    });
+    if (out)
+        out->finish();
+}
+
+// for_each_tile a pixel at a time: shade(i, j) returns the color of pixel (i, j)
+// with j = 0 at the bottom, as camera::get_ray expects.
+template <typename F>
+void render_tiles(framebuffer& fb, F shade, image_output *out = 0) {
+    for_each_tile(fb, [&](int x0, int x1, int row0, int row1) {
+        for (int row = row0; row < row1; row++) {
+            int j = fb.ny - 1 - row;
+            for (int i = x0; i < x1; i++)
+                fb.at(i, row) = shade(i, j);
+        }
+    }, out);
+}
+
+#endif
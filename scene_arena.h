@@ -0,0 +1,243 @@
+#ifndef SCENEARENAH
+#define SCENEARENAH
+
+#include <stddef.h>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+class hittable;
+class material;
+class texture;
+
+// Owns everything made while a scene is built. Objects are bumped one after
+// another into large blocks, so a primitive lands next to the material and
+// texture made for it, and release drops the blocks all at once. Objects with
+// destructors (the BVHs hold vectors) are recorded and destroyed in reverse
+// order first; the rest are never visited.
+//
+// The stats count both what the arena hands out and what the objects made in
+// it hold in their own vectors, as reported by their memory_bytes when the
+// stats are read.
+class scene_arena {
+    public:
+        enum category { hittables, materials, textures, lists, other, category_count };
+
+        scene_arena(size_t block_size = 1 << 16) : block_size(block_size) { clear_stats(); }
+        ~scene_arena() { release(); }
+
+        void *allocate(size_t bytes, size_t align, category c);
+        // Calls fn(p) on release, before the blocks are freed.
+        void on_release(void (*fn)(void*), void *p) {
+            cleanup c = { fn, p };
+            cleanups.push_back(c);
+        }
+        // Counts fn(p) towards bytes_held(c) while the arena lives.
+        void on_measure(size_t (*fn)(const void*), const void *p, category c) {
+            measure m = { fn, p, c };
+            measures.push_back(m);
+        }
+        void release();
+
+        // Bytes the arena handed out for objects of c.
+        size_t bytes_used(category c) const { return used[c]; }
+        // Bytes objects of c hold outside the arena.
+        size_t bytes_held(category c) const;
+        // Both, over every category.
+        size_t bytes_used() const;
+        size_t objects(category c) const { return count[c]; }
+        size_t bytes_reserved() const { return reserved; }
+        void print_stats(std::ostream& os) const;
+
+    private:
+        scene_arena(const scene_arena&);
+        scene_arena& operator=(const scene_arena&);
+        void clear_stats();
+
+        struct block {
+            char *data;
+            size_t size;
+            size_t top;
+        };
+        struct cleanup {
+            void (*fn)(void*);
+            void *p;
+        };
+        struct measure {
+            size_t (*fn)(const void*);
+            const void *p;
+            category c;
+        };
+        size_t block_size;
+        std::vector<block> blocks;
+        std::vector<cleanup> cleanups;
+        std::vector<measure> measures;
+        size_t used[category_count];
+        size_t count[category_count];
+        size_t reserved;
+};
+
+void *scene_arena::allocate(size_t bytes, size_t align, category c) {
+    used[c] += bytes;
+    count[c]++;
+    if (!blocks.empty()) {
+        block& b = blocks.back();
+        size_t start = (b.top + align - 1) & ~(align - 1);
+        if (start + bytes <= b.size) {
+            b.top = start + bytes;
+            return b.data + start;
+        }
+    }
+    // objects bigger than a block get a block of their own
+    block b;
+    b.size = bytes > block_size ? bytes : block_size;
+    b.data = static_cast<char*>(::operator new(b.size));
+    b.top = bytes;
+    reserved += b.size;
+    if (bytes > block_size && !blocks.empty())
+        blocks.insert(blocks.end() - 1, b);  // keep filling the current block
+    else
+        blocks.push_back(b);
+    return b.data;
+}
+
+void scene_arena::release() {
+    for (size_t i = cleanups.size(); i-- > 0;)
+        cleanups[i].fn(cleanups[i].p);
+    cleanups.clear();
+    measures.clear();
+    for (size_t i = 0; i < blocks.size(); i++)
+        ::operator delete(blocks[i].data);
+    blocks.clear();
+    clear_stats();
+}
+
+void scene_arena::clear_stats() {
+    for (int c = 0; c < category_count; c++)
+        used[c] = count[c] = 0;
+    reserved = 0;
+}
+
+size_t scene_arena::bytes_held(category c) const {
+    size_t total = 0;
+    for (size_t i = 0; i < measures.size(); i++)
+        if (measures[i].c == c)
+            total += measures[i].fn(measures[i].p);
+    return total;
+}
+
+size_t scene_arena::bytes_used() const {
+    size_t total = 0;
+    for (int c = 0; c < category_count; c++)
+        total += used[c];
+    for (size_t i = 0; i < measures.size(); i++)
+        total += measures[i].fn(measures[i].p);
+    return total;
+}
+
+void scene_arena::print_stats(std::ostream& os) const {
+    static const char *names[category_count] = { "primitives", "materials", "textures", "lists", "other" };
+    for (int c = 0; c < category_count; c++)
+        if (count[c] > 0) {
+            os << "  " << names[c] << ": " << count[c] << " objects, " << used[c] << " bytes";
+            size_t held = bytes_held(category(c));
+            if (held > 0)
+                os << " + " << held << " bytes of arrays";
+            os << "\n";
+        }
+    os << "  scene total: " << bytes_used() << " bytes, " << reserved << " reserved in the arena\n";
+}
+
+
+// The arena scene_new allocates from on this thread, or null for the heap.
+inline scene_arena*& current_scene_arena() {
+    static thread_local scene_arena *arena = 0;
+    return arena;
+}
+
+// Makes arena current for the life of the scope, restoring the previous one
+// after.
+class scene_arena_scope {
+    public:
+        scene_arena_scope(scene_arena& arena) : previous(current_scene_arena()) { current_scene_arena() = &arena; }
+        ~scene_arena_scope() { current_scene_arena() = previous; }
+    private:
+        scene_arena_scope(const scene_arena_scope&);
+        scene_arena_scope& operator=(const scene_arena_scope&);
+        scene_arena *previous;
+};
+
+template <typename T>
+scene_arena::category scene_category() {
+    if (std::is_base_of<hittable, T>::value) return scene_arena::hittables;
+    if (std::is_base_of<material, T>::value) return scene_arena::materials;
+    if (std::is_base_of<texture, T>::value) return scene_arena::textures;
+    return scene_arena::other;
+}
+
+template <typename T>
+void destroy_in_arena(void *p) {
+    static_cast<T*>(p)->~T();
+}
+
+template <typename T>
+size_t measure_in_arena(const void *p) {
+    return static_cast<const T*>(p)->memory_bytes();
+}
+
+// Whether T declares a memory_bytes of its own, rather than inheriting
+// hittable's, which holds nothing; only those are measured, so the many small
+// primitives and instances of a scene cost no record.
+template <typename T, typename = void>
+struct declares_memory_bytes : std::false_type {};
+
+template <typename T>
+struct declares_memory_bytes<T, decltype(void(&T::memory_bytes))>
+    : std::is_same<decltype(&T::memory_bytes), size_t (T::*)() const> {};
+
+template <typename T>
+void track_held_bytes(scene_arena *arena, T *p, std::true_type) {
+    arena->on_measure(measure_in_arena<T>, p, scene_category<T>());
+}
+
+template <typename T>
+void track_held_bytes(scene_arena *, T *, std::false_type) {}
+
+// new T(args...), in the current scene arena when there is one. Nothing made
+// here should be deleted; the arena frees it, and without an arena it lives
+// as long as the program, as scenes always have.
+template <typename T, typename... Args>
+T *scene_new(Args&&... args) {
+    scene_arena *arena = current_scene_arena();
+    if (!arena)
+        return new T(std::forward<Args>(args)...);
+    static_assert(alignof(T) <= alignof(max_align_t), "scene_new: over-aligned type");
+    T *p = new (arena->allocate(sizeof(T), alignof(T), scene_category<T>())) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value)
+        arena->on_release(destroy_in_arena<T>, p);
+    track_held_bytes(arena, p, declares_memory_bytes<T>());
+    return p;
+}
+
+// An uninitialised array of n T, such as the hittable* lists scenes fill in.
+template <typename T>
+T *scene_array(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value, "scene_array: T needs a destructor");
+    scene_arena *arena = current_scene_arena();
+    if (!arena)
+        return new T[n];
+    return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T), scene_arena::lists));
+}
+
+// Hands memory from a C allocator, such as stbi_load's pixels, to the current
+// arena to free on release.
+inline void scene_adopt(void *p, void (*free_fn)(void*)) {
+    scene_arena *arena = current_scene_arena();
+    if (arena && p)
+        arena->on_release(free_fn, p);
+}
+
+#endif
@@ -0,0 +1,388 @@
+//==================================================================================================
+// Written in 2016 by Peter Shirley <ptrshrl@gmail.com>
+//
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is distributed
+// without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication along
+// with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==================================================================================================
+
+
+#ifndef SCENESH
+#define SCENESH
+
+// The built-in scenes, shared by main.cpp and benchmark.cpp.
+
+#include "aarect.h"
+#include "box.h"
+#include "box_set.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "moving_sphere.h"
+#include "random.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "surface_texture.h"
+#include "texture.h"
+#include "triangle_mesh.h"
+
+
+hittable *random_scene_InOneWeekend() {
+	sphere_set *spheres = scene_new<sphere_set>();
+	spheres->add(vec3(0, -1000, 0), 1000, scene_new<lambertian>(vec3(0.5, 0.5, 0.5)));
+	for (int a = -11; a < 11; a++) {
+		for (int b = -11; b < 11; b++) {
+			float choose_mat = random_double();
+			vec3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+			if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
+				if (choose_mat < 0.8) {  // diffuse
+					spheres->add(
+						center, 0.2,
+						scene_new<lambertian>(vec3(random_double()*random_double(),
+							random_double()*random_double(),
+							random_double()*random_double()))
+					);
+				}
+				else if (choose_mat < 0.95) { // metal
+					spheres->add(
+						center, 0.2,
+						scene_new<metal>(vec3(0.5*(1 + random_double()),
+							0.5*(1 + random_double()),
+							0.5*(1 + random_double())),
+							0.5*random_double())
+					);
+				}
+				else {  // glass
+					spheres->add(center, 0.2, scene_new<dielectric>(1.5));
+				}
+			}
+		}
+	}
+
+	spheres->add(vec3(0, 1, 0), 1.0, scene_new<dielectric>(1.5));
+	spheres->add(vec3(-4, 1, 0), 1.0, scene_new<lambertian>(vec3(0.4, 0.2, 0.1)));
+	spheres->add(vec3(4, 1, 0), 1.0, scene_new<metal>(vec3(0.7, 0.6, 0.5), 0.0));
+
+	spheres->build();
+	return spheres;
+}
+
+
+hittable *earth() {
+	//material *mat = scene_new<lambertian>(scene_new<image_texture>("tiled.jpg"));
+	material *mat = scene_new<lambertian>(scene_new<image_texture>("earthmap.jpg"));
+	return scene_new<sphere>(vec3(0, 0, 0), 2, mat);
+}
+
+hittable *two_spheres() {
+	texture *checker = scene_new<checker_texture>(scene_new<constant_texture>(vec3(0.2, 0.3, 0.1)), scene_new<constant_texture>(vec3(0.9, 0.9, 0.9)));
+	hittable **list = scene_array<hittable*>(2);
+	list[0] = scene_new<sphere>(vec3(0, -10, 0), 10, scene_new<lambertian>(checker));
+	list[1] = scene_new<sphere>(vec3(0, 10, 0), 10, scene_new<lambertian>(checker));
+
+	return scene_new<hittable_list>(list, 2);
+}
+
+hittable *final() {
+	int nb = 20;
+	int ns = 1000;
+	hittable **list = scene_array<hittable*>(11);
+	box_set *ground_boxes = scene_new<box_set>();
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	material *ground = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.48, 0.83, 0.53)));
+	for (int i = 0; i < nb; i++) {
+		for (int j = 0; j < nb; j++) {
+			float w = 100;
+			float x0 = -1000 + i * w;
+			float z0 = -1000 + j * w;
+			float y0 = 0;
+			float x1 = x0 + w;
+			float y1 = 100 * (random_double() + 0.01);
+			float z1 = z0 + w;
+			ground_boxes->add(vec3(x0, y0, z0), vec3(x1, y1, z1), ground);
+		}
+	}
+	ground_boxes->build();
+	int l = 0;
+	list[l++] = ground_boxes;
+	material *light = scene_new<diffuse_light>(scene_new<constant_texture>(vec3(7, 7, 7)));
+	list[l++] = scene_new<xz_rect>(123, 423, 147, 412, 554, light);
+	vec3 center(400, 400, 200);
+	list[l++] = scene_new<moving_sphere>(center, center + vec3(30, 0, 0), 0, 1, 50, scene_new<lambertian>(scene_new<constant_texture>(vec3(0.7, 0.3, 0.1))));
+	list[l++] = scene_new<sphere>(vec3(260, 150, 45), 50, scene_new<dielectric>(1.5));
+	list[l++] = scene_new<sphere>(vec3(0, 150, 145), 50, scene_new<metal>(vec3(0.8, 0.8, 0.9), 10.0));
+	hittable *boundary = scene_new<sphere>(vec3(360, 150, 145), 70, scene_new<dielectric>(1.5));
+	list[l++] = boundary;
+	list[l++] = scene_new<constant_medium>(boundary, 0.2, scene_new<constant_texture>(vec3(0.2, 0.4, 0.9)));
+	boundary = scene_new<sphere>(vec3(0, 0, 0), 5000, scene_new<dielectric>(1.5));
+	list[l++] = scene_new<constant_medium>(boundary, 0.0001, scene_new<constant_texture>(vec3(1.0, 1.0, 1.0)));
+	material *emat = scene_new<lambertian>(scene_new<image_texture>("earthmap.jpg"));
+	list[l++] = scene_new<sphere>(vec3(400, 200, 400), 100, emat);
+	texture *pertext = scene_new<noise_texture>(0.1);
+	list[l++] = scene_new<sphere>(vec3(220, 280, 300), 80, scene_new<lambertian>(pertext));
+	sphere_set *cluster = scene_new<sphere_set>();
+	for (int j = 0; j < ns; j++) {
+		cluster->add(vec3(165 * random_double(), 165 * random_double(), 165 * random_double()), 10, white);
+	}
+	cluster->build();
+	list[l++] = scene_new<instance>(cluster, translation(vec3(-100, 270, 395)) * rotation_y(15));
+	return scene_new<hittable_list>(list, l);
+}
+
+hittable *cornell_final() {
+	hittable **list = scene_array<hittable*>(13);
+	texture *pertext = scene_new<noise_texture>(0.1);
+	material *mat = scene_new<lambertian>(scene_new<image_texture>("earthmap.jpg"));
+	int i = 0;
+	material *red = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.65, 0.05, 0.05)));
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	material *green = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.12, 0.45, 0.15)));
+	material *light = scene_new<diffuse_light>(scene_new<constant_texture>(vec3(7, 7, 7)));
+	//list[i++] = scene_new<sphere>(vec3(260, 50, 145), 50,mat);
+	list[i++] = scene_new<flip_normals>(scene_new<yz_rect>(0, 555, 0, 555, 555, green));
+	list[i++] = scene_new<yz_rect>(0, 555, 0, 555, 0, red);
+	list[i++] = scene_new<xz_rect>(123, 423, 147, 412, 554, light);
+	list[i++] = scene_new<flip_normals>(scene_new<xz_rect>(0, 555, 0, 555, 555, white));
+	list[i++] = scene_new<xz_rect>(0, 555, 0, 555, 0, white);
+	list[i++] = scene_new<flip_normals>(scene_new<xy_rect>(0, 555, 0, 555, 555, white));
+	/*
+	hittable *boundary = scene_new<sphere>(vec3(160, 50, 345), 50, scene_new<dielectric>(1.5));
+	list[i++] = boundary;
+	list[i++] = scene_new<constant_medium>(boundary, 0.2, scene_new<constant_texture>(vec3(0.2, 0.4, 0.9)));
+	list[i++] = scene_new<sphere>(vec3(460, 50, 105), 50, scene_new<dielectric>(1.5));
+	list[i++] = scene_new<sphere>(vec3(120, 50, 205), 50, scene_new<lambertian>(pertext));
+	int ns = 10000;
+	sphere_set *cluster = scene_new<sphere_set>();
+	for (int j = 0; j < ns; j++) {
+		cluster->add(vec3(165*random_double(), 330*random_double(), 165*random_double()), 10, white);
+	}
+	cluster->build();
+	list[i++] =   scene_new<instance>(cluster, translation(vec3(265,0,295)) * rotation_y(15));
+	*/
+	hittable *boundary2 = scene_new<instance>(scene_new<box>(vec3(0, 0, 0), vec3(165, 165, 165), scene_new<dielectric>(1.5)), translation(vec3(130, 0, 65)) * rotation_y(-18));
+	list[i++] = boundary2;
+	list[i++] = scene_new<constant_medium>(boundary2, 0.2, scene_new<constant_texture>(vec3(0.9, 0.9, 0.9)));
+	return scene_new<hittable_list>(list, i);
+}
+
+hittable *cornell_balls() {
+	hittable **list = scene_array<hittable*>(9);
+	int i = 0;
+	material *red = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.65, 0.05, 0.05)));
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	material *green = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.12, 0.45, 0.15)));
+	material *light = scene_new<diffuse_light>(scene_new<constant_texture>(vec3(5, 5, 5)));
+	list[i++] = scene_new<flip_normals>(scene_new<yz_rect>(0, 555, 0, 555, 555, green));
+	list[i++] = scene_new<yz_rect>(0, 555, 0, 555, 0, red);
+	list[i++] = scene_new<xz_rect>(113, 443, 127, 432, 554, light);
+	list[i++] = scene_new<flip_normals>(scene_new<xz_rect>(0, 555, 0, 555, 555, white));
+	list[i++] = scene_new<xz_rect>(0, 555, 0, 555, 0, white);
+	list[i++] = scene_new<flip_normals>(scene_new<xy_rect>(0, 555, 0, 555, 555, white));
+	hittable *boundary = scene_new<sphere>(vec3(160, 100, 145), 100, scene_new<dielectric>(1.5));
+	list[i++] = boundary;
+	list[i++] = scene_new<constant_medium>(boundary, 0.1, scene_new<constant_texture>(vec3(1.0, 1.0, 1.0)));
+	list[i++] = scene_new<instance>(scene_new<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), translation(vec3(265, 0, 295)) * rotation_y(15));
+	return scene_new<hittable_list>(list, i);
+}
+
+hittable *cornell_smoke() {
+	hittable **list = scene_array<hittable*>(8);
+	int i = 0;
+	material *red = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.65, 0.05, 0.05)));
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	material *green = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.12, 0.45, 0.15)));
+	material *light = scene_new<diffuse_light>(scene_new<constant_texture>(vec3(7, 7, 7)));
+	list[i++] = scene_new<flip_normals>(scene_new<yz_rect>(0, 555, 0, 555, 555, green));
+	list[i++] = scene_new<yz_rect>(0, 555, 0, 555, 0, red);
+	list[i++] = scene_new<xz_rect>(113, 443, 127, 432, 554, light);
+	list[i++] = scene_new<flip_normals>(scene_new<xz_rect>(0, 555, 0, 555, 555, white));
+	list[i++] = scene_new<xz_rect>(0, 555, 0, 555, 0, white);
+	list[i++] = scene_new<flip_normals>(scene_new<xy_rect>(0, 555, 0, 555, 555, white));
+	hittable *b1 = scene_new<instance>(scene_new<box>(vec3(0, 0, 0), vec3(165, 165, 165), white), translation(vec3(130, 0, 65)) * rotation_y(-18));
+	hittable *b2 = scene_new<instance>(scene_new<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), translation(vec3(265, 0, 295)) * rotation_y(15));
+	list[i++] = scene_new<constant_medium>(b1, 0.01, scene_new<constant_texture>(vec3(1.0, 1.0, 1.0)));
+	list[i++] = scene_new<constant_medium>(b2, 0.01, scene_new<constant_texture>(vec3(0.0, 0.0, 0.0)));
+	return scene_new<hittable_list>(list, i);
+}
+
+hittable *cornell_box() {
+	hittable **list = scene_array<hittable*>(8);
+	int i = 0;
+	material *red = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.65, 0.05, 0.05)));
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	material *green = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.12, 0.45, 0.15)));
+	material *light = scene_new<diffuse_light>(scene_new<constant_texture>(vec3(15, 15, 15)));
+	list[i++] = scene_new<flip_normals>(scene_new<yz_rect>(0, 555, 0, 555, 555, green));
+	list[i++] = scene_new<yz_rect>(0, 555, 0, 555, 0, red);
+	list[i++] = scene_new<xz_rect>(213, 343, 227, 332, 554, light);
+	list[i++] = scene_new<flip_normals>(scene_new<xz_rect>(0, 555, 0, 555, 555, white));
+	list[i++] = scene_new<xz_rect>(0, 555, 0, 555, 0, white);
+	list[i++] = scene_new<flip_normals>(scene_new<xy_rect>(0, 555, 0, 555, 555, white));
+	list[i++] = scene_new<instance>(scene_new<box>(vec3(0, 0, 0), vec3(165, 165, 165), white), translation(vec3(130, 0, 65)) * rotation_y(-18));
+	list[i++] = scene_new<instance>(scene_new<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), translation(vec3(265, 0, 295)) * rotation_y(15));
+	return scene_new<hittable_list>(list, i);
+}
+
+hittable *two_perlin_spheres() {
+	texture *pertext = scene_new<noise_texture>(4);
+	hittable **list = scene_array<hittable*>(2);
+	list[0] = scene_new<sphere>(vec3(0, -1000, 0), 1000, scene_new<lambertian>(pertext));
+	list[1] = scene_new<sphere>(vec3(0, 2, 0), 2, scene_new<lambertian>(pertext));
+	return scene_new<hittable_list>(list, 2);
+}
+
+hittable *simple_light() {
+	texture *pertext = scene_new<noise_texture>(4);
+	hittable **list = scene_array<hittable*>(4);
+	list[0] = scene_new<sphere>(vec3(0, -1000, 0), 1000, scene_new<lambertian>(pertext));
+	list[1] = scene_new<sphere>(vec3(0, 2, 0), 2, scene_new<lambertian>(pertext));
+	list[2] = scene_new<sphere>(vec3(0, 7, 0), 2, scene_new<diffuse_light>(scene_new<constant_texture>(vec3(4, 4, 4))));
+	list[3] = scene_new<xy_rect>(3, 5, 1, 3, -2, scene_new<diffuse_light>(scene_new<constant_texture>(vec3(4, 4, 4))));
+	return scene_new<hittable_list>(list, 4);
+}
+
+hittable *random_scene() {
+	texture *checker = scene_new<checker_texture>(scene_new<constant_texture>(vec3(0.2, 0.3, 0.1)), scene_new<constant_texture>(vec3(0.9, 0.9, 0.9)));
+	sphere_set *spheres = scene_new<sphere_set>();
+	spheres->add(vec3(0, -1000, 0), 1000, scene_new<lambertian>(checker));
+	for (int a = -10; a < 10; a++) {
+		for (int b = -10; b < 10; b++) {
+			float choose_mat = random_double();
+			vec3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
+			if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
+				if (choose_mat < 0.8) {  // diffuse
+					spheres->add_moving(center, center + vec3(0, 0.5*random_double(), 0), 0.0, 1.0, 0.2, scene_new<lambertian>(scene_new<constant_texture>(vec3(random_double()*random_double(), random_double()*random_double(), random_double()*random_double()))));
+				}
+				else if (choose_mat < 0.95) { // metal
+					spheres->add(center, 0.2,
+						scene_new<metal>(vec3(0.5*(1 + random_double()), 0.5*(1 + random_double()), 0.5*(1 + random_double())), 0.5*random_double()));
+				}
+				else {  // glass
+					spheres->add(center, 0.2, scene_new<dielectric>(1.5));
+				}
+			}
+		}
+	}
+
+	spheres->add(vec3(0, 1, 0), 1.0, scene_new<dielectric>(1.5));
+	spheres->add(vec3(-4, 1, 0), 1.0, scene_new<lambertian>(scene_new<constant_texture>(vec3(0.4, 0.2, 0.1))));
+	spheres->add(vec3(4, 1, 0), 1.0, scene_new<metal>(vec3(0.7, 0.6, 0.5), 0.0));
+
+	spheres->build();
+	return spheres;
+}
+
+
+// A field of about 100,000 trees that are all instances of one tree, each
+// with its own position, turn and size, and every third one in autumn
+// colours through a material override.
+hittable *forest() {
+	material *bark = scene_new<lambertian>(vec3(0.3, 0.2, 0.1));
+	material *leaves = scene_new<lambertian>(vec3(0.1, 0.4, 0.1));
+	material *autumn = scene_new<lambertian>(vec3(0.7, 0.3, 0.05));
+	hittable **parts = scene_array<hittable*>(2);
+	parts[0] = scene_new<box>(vec3(-0.1, 0, -0.1), vec3(0.1, 1, 0.1), bark);
+	sphere_set *crown = scene_new<sphere_set>();
+	for (int k = 0; k < 40; k++) {
+		float y = 0.8 + 1.6*random_double();
+		float spread = 0.6*(2.4 - y);
+		crown->add(vec3(spread*(2*random_double() - 1), y, spread*(2*random_double() - 1)), 0.25, leaves);
+	}
+	crown->build();
+	parts[1] = crown;
+	hittable *tree = scene_new<linear_bvh>(parts, 2, 0.0, 1.0);
+
+	int n = 320;
+	hittable **trees = scene_array<hittable*>(n*n);
+	int i = 0;
+	for (int a = 0; a < n; a++) {
+		for (int b = 0; b < n; b++) {
+			vec3 at(3*a + 2*random_double(), 0, 3*b + 2*random_double());
+			float turn = 360*random_double();
+			float size = 0.7 + 0.6*random_double();
+			transform placement = translation(at) * rotation_y(turn) * scaling(vec3(size, size, size));
+			trees[i] = scene_new<instance>(tree, placement, i % 3 == 0 ? autumn : 0);
+			i++;
+		}
+	}
+	hittable **list = scene_array<hittable*>(2);
+	list[0] = scene_new<sphere>(vec3(0, -1000, 0), 1000, scene_new<lambertian>(vec3(0.4, 0.35, 0.2)));
+	list[1] = scene_new<linear_bvh>(trees, i, 0.0, 1.0);
+	return scene_new<hittable_list>(list, 2);
+}
+
+void cornell_box(hittable **scene, camera **cam, float aspect) {
+	int i = 0;
+	hittable **list = scene_array<hittable*>(8);
+	material *red = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.65, 0.05, 0.05)));
+	material *white = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.73, 0.73, 0.73)));
+	material *green = scene_new<lambertian>(scene_new<constant_texture>(vec3(0.12, 0.45, 0.15)));
+	material *light = scene_new<diffuse_light>(scene_new<constant_texture>(vec3(15, 15, 15)));
+	list[i++] = scene_new<flip_normals>(scene_new<yz_rect>(0, 555, 0, 555, 555, green));
+	list[i++] = scene_new<yz_rect>(0, 555, 0, 555, 0, red);
+	list[i++] = scene_new<flip_normals>(scene_new<xz_rect>(213, 343, 227, 332, 554, light));
+	list[i++] = scene_new<flip_normals>(scene_new<xz_rect>(0, 555, 0, 555, 555, white));
+	list[i++] = scene_new<xz_rect>(0, 555, 0, 555, 0, white);
+	list[i++] = scene_new<flip_normals>(scene_new<xy_rect>(0, 555, 0, 555, 555, white));
+	material *glass = scene_new<dielectric>(1.5);
+	list[i++] = scene_new<sphere>(vec3(190, 90, 190), 90, glass);
+	list[i++] = scene_new<instance>(
+		scene_new<box>(vec3(0, 0, 0), vec3(165, 330, 165), white), translation(vec3(265, 0, 295)) * rotation_y(15));
+	*scene = scene_new<hittable_list>(list, i);
+	vec3 lookfrom(278, 278, -800);
+	vec3 lookat(278, 278, 0);
+	float dist_to_focus = 10.0;
+	float aperture = 0.0;
+	float vfov = 40.0;
+	*cam = scene_new<camera>(lookfrom, lookat, vec3(0, 1, 0),
+		vfov, aspect, aperture, dist_to_focus, 0.0, 1.0);
+}
+
+// A height field of n by n quads over [-size/2, size/2] in x and z, two
+// triangles each, with each vertex's normal averaged over the faces around it.
+triangle_mesh *terrain_mesh(int n, float size, float height, material *m) {
+	mesh_buffers *buffers = scene_new<mesh_buffers>();
+	for (int b = 0; b <= n; b++) {
+		for (int a = 0; a <= n; a++) {
+			float x = size*(float(a)/n - 0.5), z = size*(float(b)/n - 0.5);
+			float u = 6.2831853f*x/size, v = 6.2831853f*z/size;
+			buffers->positions.push_back(vec3(x, height*(sin(2*u)*cos(1.5*v) + 0.3*sin(5*u + 3*v)), z));
+		}
+	}
+	buffers->normals.assign(buffers->positions.size(), vec3(0, 0, 0));
+	std::vector<mesh_triangle> tris;
+	for (int b = 0; b < n; b++) {
+		for (int a = 0; a < n; a++) {
+			int v00 = b*(n + 1) + a, v10 = v00 + 1, v01 = v00 + n + 1, v11 = v01 + 1;
+			mesh_triangle lower = { { v00, v01, v10 } }, upper = { { v10, v01, v11 } };
+			tris.push_back(lower);
+			tris.push_back(upper);
+		}
+	}
+	const std::vector<vec3>& P = buffers->positions;
+	for (size_t t = 0; t < tris.size(); t++) {
+		const int *v = tris[t].v;
+		vec3 face = cross(P[v[1]] - P[v[0]], P[v[2]] - P[v[0]]);
+		for (int k = 0; k < 3; k++)
+			buffers->normals[v[k]] += face;
+	}
+	for (size_t i = 0; i < buffers->normals.size(); i++)
+		buffers->normals[i].make_unit_vector();
+	return scene_new<triangle_mesh>(buffers, tris, m);
+}
+
+hittable *terrain() {
+	hittable **list = scene_array<hittable*>(3);
+	list[0] = terrain_mesh(256, 100, 6, scene_new<lambertian>(vec3(0.45, 0.4, 0.3)));
+	list[1] = scene_new<sphere>(vec3(-4, 10, 2), 4, scene_new<dielectric>(1.5));
+	list[2] = scene_new<sphere>(vec3(8, 9, -6), 3, scene_new<metal>(vec3(0.7, 0.6, 0.5), 0.1));
+	return scene_new<hittable_list>(list, 3);
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef SIMDH
+#define SIMDH
+
+#include "ray.h"
+
+#include <float.h>
+
+
+// A thin layer over 4- and 8-wide float vectors: SSE and AVX when the compiler
+// targets them (-msse2 / -mavx, /arch:AVX), plain loops otherwise. float8 is
+// two float4s without AVX. Only what the slab and sphere tests need is here.
+#if defined(__AVX__)
+#define SIMD_AVX 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(SIMD_AVX)
+#define SIMD_SSE 1
+#endif
+
+#if defined(SIMD_AVX)
+#include <immintrin.h>
+#elif defined(SIMD_SSE)
+#include <emmintrin.h>
+#endif
+
+
+#if defined(SIMD_SSE)
+struct float4 {
+    float4() {}
+    float4(__m128 x) : v(x) {}
+    explicit float4(float x) : v(_mm_set1_ps(x)) {}
+    static float4 load(const float *p) { return float4(_mm_loadu_ps(p)); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+    __m128 v;
+};
+inline float4 operator+(float4 a, float4 b) { return float4(_mm_add_ps(a.v, b.v)); }
+inline float4 operator-(float4 a, float4 b) { return float4(_mm_sub_ps(a.v, b.v)); }
+inline float4 operator*(float4 a, float4 b) { return float4(_mm_mul_ps(a.v, b.v)); }
+inline float4 operator/(float4 a, float4 b) { return float4(_mm_div_ps(a.v, b.v)); }
+inline float4 min(float4 a, float4 b) { return float4(_mm_min_ps(a.v, b.v)); }
+inline float4 max(float4 a, float4 b) { return float4(_mm_max_ps(a.v, b.v)); }
+inline float4 sqrt(float4 a) { return float4(_mm_sqrt_ps(a.v)); }
+// bit k is set where a[k] <= b[k]
+inline int le_mask(float4 a, float4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+inline int lt_mask(float4 a, float4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+#else
+struct float4 {
+    float4() {}
+    explicit float4(float x) { for (int k = 0; k < 4; k++) v[k] = x; }
+    static float4 load(const float *p) { float4 r; for (int k = 0; k < 4; k++) r.v[k] = p[k]; return r; }
+    void store(float *p) const { for (int k = 0; k < 4; k++) p[k] = v[k]; }
+    float v[4];
+};
+#define SIMD_LANEWISE4(name, expr) \
+    inline float4 name(float4 a, float4 b) { float4 r; for (int k = 0; k < 4; k++) r.v[k] = (expr); return r; }
+SIMD_LANEWISE4(operator+, a.v[k] + b.v[k])
+SIMD_LANEWISE4(operator-, a.v[k] - b.v[k])
+SIMD_LANEWISE4(operator*, a.v[k] * b.v[k])
+SIMD_LANEWISE4(operator/, a.v[k] / b.v[k])
+SIMD_LANEWISE4(min, a.v[k] < b.v[k] ? a.v[k] : b.v[k])
+SIMD_LANEWISE4(max, a.v[k] > b.v[k] ? a.v[k] : b.v[k])
+#undef SIMD_LANEWISE4
+inline float4 sqrt(float4 a) { float4 r; for (int k = 0; k < 4; k++) r.v[k] = sqrtf(a.v[k]); return r; }
+inline int le_mask(float4 a, float4 b) {
+    int m = 0;
+    for (int k = 0; k < 4; k++)
+        m |= (a.v[k] <= b.v[k]) << k;
+    return m;
+}
+inline int lt_mask(float4 a, float4 b) {
+    int m = 0;
+    for (int k = 0; k < 4; k++)
+        m |= (a.v[k] < b.v[k]) << k;
+    return m;
+}
+#endif
+
+#if defined(SIMD_AVX)
+struct float8 {
+    float8() {}
+    float8(__m256 x) : v(x) {}
+    explicit float8(float x) : v(_mm256_set1_ps(x)) {}
+    static float8 load(const float *p) { return float8(_mm256_loadu_ps(p)); }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+    __m256 v;
+};
+inline float8 operator+(float8 a, float8 b) { return float8(_mm256_add_ps(a.v, b.v)); }
+inline float8 operator-(float8 a, float8 b) { return float8(_mm256_sub_ps(a.v, b.v)); }
+inline float8 operator*(float8 a, float8 b) { return float8(_mm256_mul_ps(a.v, b.v)); }
+inline float8 operator/(float8 a, float8 b) { return float8(_mm256_div_ps(a.v, b.v)); }
+inline float8 min(float8 a, float8 b) { return float8(_mm256_min_ps(a.v, b.v)); }
+inline float8 max(float8 a, float8 b) { return float8(_mm256_max_ps(a.v, b.v)); }
+inline float8 sqrt(float8 a) { return float8(_mm256_sqrt_ps(a.v)); }
+inline int le_mask(float8 a, float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+inline int lt_mask(float8 a, float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+#else
+struct float8 {
+    float8() {}
+    float8(float4 a, float4 b) : lo(a), hi(b) {}
+    explicit float8(float x) : lo(x), hi(x) {}
+    static float8 load(const float *p) { return float8(float4::load(p), float4::load(p + 4)); }
+    void store(float *p) const { lo.store(p); hi.store(p + 4); }
+    float4 lo, hi;
+};
+inline float8 operator+(float8 a, float8 b) { return float8(a.lo + b.lo, a.hi + b.hi); }
+inline float8 operator-(float8 a, float8 b) { return float8(a.lo - b.lo, a.hi - b.hi); }
+inline float8 operator*(float8 a, float8 b) { return float8(a.lo * b.lo, a.hi * b.hi); }
+inline float8 operator/(float8 a, float8 b) { return float8(a.lo / b.lo, a.hi / b.hi); }
+inline float8 min(float8 a, float8 b) { return float8(min(a.lo, b.lo), min(a.hi, b.hi)); }
+inline float8 max(float8 a, float8 b) { return float8(max(a.lo, b.lo), max(a.hi, b.hi)); }
+inline float8 sqrt(float8 a) { return float8(sqrt(a.lo), sqrt(a.hi)); }
+inline int le_mask(float8 a, float8 b) { return le_mask(a.lo, b.lo) | le_mask(a.hi, b.hi) << 4; }
+inline int lt_mask(float8 a, float8 b) { return lt_mask(a.lo, b.lo) | lt_mask(a.hi, b.hi) << 4; }
+#endif
+
+
+// A ray with its reciprocal direction worked out once, for slab tests.
+// near[a] is 0 when the ray runs towards +a, so a box's entry plane on that
+// axis is its min, and 1 when it runs towards -a.
+struct ray_inv {
+    ray_inv() {}
+    ray_inv(const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            o[a] = r.origin()[a];
+            inv[a] = 1.0f / r.direction()[a];
+            near[a] = inv[a] < 0;
+        }
+    }
+    float o[3];
+    float inv[3];
+    int near[3];
+};
+
+// W boxes side by side, one lane each: bounds[0] holds the min corners and
+// bounds[1] the max corners, one row per axis. Unused lanes should be empty
+// boxes (min FLT_MAX, max -FLT_MAX) so they never test as hit.
+template <int W>
+struct box_lanes {
+    float bounds[2][3][W];
+};
+
+typedef box_lanes<4> box4;
+typedef box_lanes<8> box8;
+
+// The vector type with W lanes.
+template <int W> struct simd_float;
+template <> struct simd_float<4> { typedef float4 type; };
+template <> struct simd_float<8> { typedef float8 type; };
+
+template <int W>
+void clear_lanes(box_lanes<W>& b) {
+    for (int a = 0; a < 3; a++)
+        for (int k = 0; k < W; k++) {
+            b.bounds[0][a][k] = FLT_MAX;
+            b.bounds[1][a][k] = -FLT_MAX;
+        }
+}
+
+// out = a + s * (b - a), lane by lane. Empty lanes stay empty when they are
+// empty in both.
+template <typename V, int W>
+inline void lerp_lanes(const box_lanes<W>& a, const box_lanes<W>& b, float s, box_lanes<W>& out) {
+    V vs(s);
+    for (int side = 0; side < 2; side++)
+        for (int axis = 0; axis < 3; axis++) {
+            V va = V::load(a.bounds[side][axis]);
+            (va + vs * (V::load(b.bounds[side][axis]) - va)).store(out.bounds[side][axis]);
+        }
+}
+
+// Tests r against every box in b at once. Returns a bit per box that the ray
+// enters within [t_min, t_max] and writes the entry distances to t_near.
+template <typename V, int W>
+inline int slab_test(const box_lanes<W>& b, const ray_inv& r, float t_min, float t_max, float *t_near) {
+    V t0(t_min), t1(t_max);
+    for (int a = 0; a < 3; a++) {
+        V o(r.o[a]), inv(r.inv[a]);
+        V enter = (V::load(b.bounds[r.near[a]][a]) - o) * inv;
+        V leave = (V::load(b.bounds[1 - r.near[a]][a]) - o) * inv;
+        t0 = max(enter, t0);
+        t1 = min(leave, t1);
+    }
+    t0.store(t_near);
+    return le_mask(t0, t1);
+}
+
+inline int slab_test4(const box4& b, const ray_inv& r, float t_min, float t_max, float *t_near) {
+    return slab_test<float4, 4>(b, r, t_min, t_max, t_near);
+}
+
+inline int slab_test8(const box8& b, const ray_inv& r, float t_min, float t_max, float *t_near) {
+    return slab_test<float8, 8>(b, r, t_min, t_max, t_near);
+}
+
+#endif
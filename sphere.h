@@ -21,9 +21,17 @@ class sphere: public hittable  {
         sphere() {}
         sphere(vec3 cen, float r, material *m) : center(cen), radius(r), mat_ptr(m)  {};
         virtual bool hit(const ray& r, float tmin, float tmax, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const;
         virtual bool bounding_box(float t0, float t1, aabb& box) const;
         virtual float  pdf_value(const vec3& o, const vec3& v) const;
         virtual vec3 random(const vec3& o) const;
+        virtual void collect_lights(std::vector<hittable*>& lights) {
+            if (emits_light(mat_ptr))
+                lights.push_back(this);
+        }
+        virtual float light_power() const {
+            return 4*3.1416f*radius*radius * emitted_luminance(mat_ptr, center);
+        }
         vec3 center;
         float radius;
         material *mat_ptr;
@@ -61,21 +69,15 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     float c = dot(oc, oc) - radius*radius;
     float discriminant = b*b - a*c;
     if (discriminant > 0) {
-        float temp = (-b - sqrt(b*b-a*c))/a;
+        float root = sqrt(discriminant);
+        float temp = (-b - root)/a;
+        if (!(temp < t_max && temp > t_min))
+            temp = (-b + root)/a;
         if (temp < t_max && temp > t_min) {
             rec.t = temp;
             rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-        temp = (-b + sqrt(b*b-a*c))/a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p-center)/radius, rec.u, rec.v);
             rec.normal = (rec.p - center) / radius;
+            get_sphere_uv(rec.normal, rec.u, rec.v);
             rec.mat_ptr = mat_ptr;
             return true;
         }
@@ -83,6 +85,18 @@ bool sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
     return false;
 }
 
+// The discriminant of every lane at once; hit finishes the lanes that can hit.
+int sphere::hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+    int candidates = 0;
+    for (int k = 0; k < packet_size; k++) {
+        float ox = p.ox[k] - center[0], oy = p.oy[k] - center[1], oz = p.oz[k] - center[2];
+        float a = p.dx[k]*p.dx[k] + p.dy[k]*p.dy[k] + p.dz[k]*p.dz[k];
+        float b = ox*p.dx[k] + oy*p.dy[k] + oz*p.dz[k];
+        float c = ox*ox + oy*oy + oz*oz - radius*radius;
+        candidates |= int(b*b - a*c > 0) << k;
+    }
+    return hittable::hit_packet(p, lanes & candidates, t_min, t_max, rec);
+}
 
 #endif
 
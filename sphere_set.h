@@ -0,0 +1,265 @@
+#ifndef SPHERESETH
+#define SPHERESETH
+
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "scene_arena.h"
+#include "simd.h"
+#include "sphere.h"
+
+#include <vector>
+
+
+// Many spheres as arrays of centres, radii and materials, stored in leaf slot
+// order under their own BVH, whose leaves hold up to bvh_width spheres (more
+// where centres coincide and can't be split). A ray is tested against a leaf
+// bvh_width spheres at once, one per vector lane, and a packet against one
+// sphere at a time, one ray per lane. Only the distance and
+// the slot are kept while searching; the point, normal and uv are worked out
+// once, for the closest hit. Moving spheres keep their motion alongside, as
+// moving_sphere does; a set without any skips that arithmetic. Call build after
+// the last add. A set with moving spheres gets a motion tree over the span of
+// their times. To animate, rewrite the arrays in place (slot order) and call
+// update_bounds.
+class sphere_set : public hittable {
+    public:
+        void add(const vec3& center, float r, material *m);
+        void add_moving(const vec3& center0, const vec3& center1, float t0, float t1, float r, material *m);
+        void build();
+        int size() const { return int(mat.size()); }
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual int hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual void collect_lights(std::vector<hittable*>& lights);
+        virtual void update_bounds(float t0, float t1);
+        virtual size_t memory_bytes() const;
+
+        // bvh_width spare entries at the end, so a leaf can always be loaded in whole vectors
+        std::vector<float> cx, cy, cz, radius;
+        // the centre at time is c + ((time - time0) / span) * v, with v = center1 - center0
+        std::vector<float> vx, vy, vz, time0, span;
+        std::vector<material*> mat;
+        wide_tree wide;
+        bool moving = false;
+        float built_cost = 0;
+    private:
+        vec3 center(int slot, float time) const;
+        void fit_motion(float t0, float t1);
+        void finish(const ray& r, int slot, float t, hit_record& rec) const;
+};
+
+void sphere_set::add(const vec3& center, float r, material *m) {
+    add_moving(center, center, 0, 1, r, m);
+}
+
+void sphere_set::add_moving(const vec3& center0, const vec3& center1, float t0, float t1, float r, material *m) {
+    vec3 v = center1 - center0;
+    cx.push_back(center0[0]);
+    cy.push_back(center0[1]);
+    cz.push_back(center0[2]);
+    vx.push_back(v[0]);
+    vy.push_back(v[1]);
+    vz.push_back(v[2]);
+    time0.push_back(t0);
+    span.push_back(t1 - t0);
+    radius.push_back(r);
+    mat.push_back(m);
+    if (v[0] != 0 || v[1] != 0 || v[2] != 0)
+        moving = true;
+}
+
+vec3 sphere_set::center(int slot, float time) const {
+    vec3 c(cx[slot], cy[slot], cz[slot]);
+    if (moving)
+        c += ((time - time0[slot]) / span[slot]) * vec3(vx[slot], vy[slot], vz[slot]);
+    return c;
+}
+
+void sphere_set::build() {
+    int n = size();
+    std::vector<bvh_primitive> prims(n);
+    for (int i = 0; i < n; i++) {
+        vec3 c0(cx[i], cy[i], cz[i]), c1 = c0 + vec3(vx[i], vy[i], vz[i]), e(radius[i], radius[i], radius[i]);
+        // a motion tree is shaped by where the spheres are halfway through
+        vec3 c = 0.5f * (c0 + c1);
+        aabb box = moving && bvh_motion_segments > 0 ? aabb(c - e, c + e) : surrounding_box(aabb(c0 - e, c0 + e), aabb(c1 - e, c1 + e));
+        prims[i] = make_bvh_primitive(box, i);
+    }
+    bvh_tree tree;
+    tree.max_leaf_size = bvh_width;
+    tree.leaf_batch = bvh_width;
+    tree.build(prims);
+    wide.collapse(tree);
+    std::vector<float> *columns[] = { &cx, &cy, &cz, &radius, &vx, &vy, &vz, &time0, &span };
+    for (int c = 0; c < 9; c++) {
+        std::vector<float> sorted(n + bvh_width, c == 8 ? 1.0f : 0.0f);
+        for (int slot = 0; slot < n; slot++)
+            sorted[slot] = (*columns[c])[tree.order[slot]];
+        columns[c]->swap(sorted);
+    }
+    std::vector<material*> m(n);
+    for (int slot = 0; slot < n; slot++)
+        m[slot] = mat[tree.order[slot]];
+    mat.swap(m);
+    if (moving) {
+        float t0 = FLT_MAX, t1 = -FLT_MAX;
+        for (int slot = 0; slot < n; slot++)
+            if (vx[slot] != 0 || vy[slot] != 0 || vz[slot] != 0) {
+                t0 = ffmin(t0, time0[slot]);
+                t1 = ffmax(t1, time0[slot] + span[slot]);
+            }
+        fit_motion(t0, t1);
+    }
+    built_cost = wide.sah_cost();
+}
+
+void sphere_set::fit_motion(float t0, float t1) {
+    wide.fit_motion(moving ? bvh_motion_segments : 0, t0, t1, [&](int slot, float time) {
+        vec3 c = center(slot, time), e(radius[slot], radius[slot], radius[slot]);
+        return aabb(c - e, c + e);
+    });
+}
+
+void sphere_set::update_bounds(float t0, float t1) {
+    // a motion tree's own boxes come from its keys
+    if (!moving || bvh_motion_segments <= 0)
+        wide.refit([&](int slot) {
+            vec3 c0 = center(slot, t0), c1 = center(slot, t1), e(radius[slot], radius[slot], radius[slot]);
+            return surrounding_box(aabb(c0 - e, c0 + e), aabb(c1 - e, c1 + e));
+        });
+    fit_motion(t0, t1);
+    if (wide.sah_cost() > bvh_refit_limit * built_cost)
+        build();
+}
+
+bool sphere_set::bounding_box(float t0, float t1, aabb& box) const {
+    if (mat.empty())
+        return false;
+    box = wide.bounds(t0, t1);
+    return true;
+}
+
+void sphere_set::collect_lights(std::vector<hittable*>& lights) {
+    for (int slot = 0; slot < size(); slot++)
+        if (emits_light(mat[slot]) && vx[slot] == 0 && vy[slot] == 0 && vz[slot] == 0)
+            lights.push_back(scene_new<sphere>(vec3(cx[slot], cy[slot], cz[slot]), radius[slot], mat[slot]));
+}
+
+size_t sphere_set::memory_bytes() const {
+    size_t columns = cx.capacity() + cy.capacity() + cz.capacity() + radius.capacity()
+        + vx.capacity() + vy.capacity() + vz.capacity() + time0.capacity() + span.capacity();
+    return columns * sizeof(float) + mat.capacity() * sizeof(material*) + wide.memory_bytes();
+}
+
+void sphere_set::finish(const ray& r, int slot, float t, hit_record& rec) const {
+    rec.t = t;
+    rec.p = r.point_at_parameter(t);
+    rec.normal = (rec.p - center(slot, r.time())) / radius[slot];
+    get_sphere_uv(rec.normal, rec.u, rec.v);
+    rec.mat_ptr = mat[slot];
+}
+
+bool sphere_set::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    typedef simd_float<bvh_width>::type lanes;
+    const vec3& o = r.origin();
+    const vec3& d = r.direction();
+    lanes ox(o[0]), oy(o[1]), oz(o[2]), dx(d[0]), dy(d[1]), dz(d[2]);
+    lanes a(dot(d, d)), zero(0.0f), time(r.time());
+    int closest = -1;
+    float t_hit = t_max;
+    wide.intersect_leaves(r, t_min, t_max, [&](int first, int count, float& t_closest) {
+        bool hit_anything = false;
+        // a leaf of coincident centroids can hold more than bvh_width spheres
+        for (int chunk = first; chunk < first + count; chunk += bvh_width) {
+            int n = first + count - chunk < bvh_width ? first + count - chunk : bvh_width;
+            lanes ccx = lanes::load(&cx[chunk]), ccy = lanes::load(&cy[chunk]), ccz = lanes::load(&cz[chunk]);
+            if (moving) {
+                lanes s = (time - lanes::load(&time0[chunk])) / lanes::load(&span[chunk]);
+                ccx = ccx + s * lanes::load(&vx[chunk]);
+                ccy = ccy + s * lanes::load(&vy[chunk]);
+                ccz = ccz + s * lanes::load(&vz[chunk]);
+            }
+            lanes ocx = ox - ccx, ocy = oy - ccy, ocz = oz - ccz;
+            lanes rad = lanes::load(&radius[chunk]);
+            lanes b = ocx*dx + ocy*dy + ocz*dz;
+            lanes c = ocx*ocx + ocy*ocy + ocz*ocz - rad*rad;
+            lanes discriminant = b*b - a*c;
+            int candidates = lt_mask(zero, discriminant) & ((1 << n) - 1);
+            if (!candidates)
+                continue;
+            lanes root = sqrt(max(discriminant, zero));
+            float t_near[bvh_width], t_far[bvh_width];
+            ((zero - b - root) / a).store(t_near);
+            ((root - b) / a).store(t_far);
+            for (int k = 0; k < n; k++) {
+                if (!(candidates >> k & 1))
+                    continue;
+                float t = t_near[k];
+                if (!(t < t_closest && t > t_min)) {
+                    t = t_far[k];
+                    if (!(t < t_closest && t > t_min))
+                        continue;
+                }
+                t_closest = t_hit = t;
+                closest = chunk + k;
+                hit_anything = true;
+            }
+        }
+        return hit_anything;
+    });
+    if (closest < 0)
+        return false;
+    finish(r, closest, t_hit, rec);
+    return true;
+}
+
+int sphere_set::hit_packet(const ray_packet& p, int lanes, float t_min, float *t_max, hit_record *rec) const {
+    typedef simd_float<packet_size>::type ray_lanes;
+    ray_lanes ox = ray_lanes::load(p.ox), oy = ray_lanes::load(p.oy), oz = ray_lanes::load(p.oz);
+    ray_lanes dx = ray_lanes::load(p.dx), dy = ray_lanes::load(p.dy), dz = ray_lanes::load(p.dz);
+    ray_lanes a = dx*dx + dy*dy + dz*dz, zero(0.0f), near_limit(t_min), time = ray_lanes::load(p.time);
+    int closest[packet_size];
+    int hits = wide.intersect_packet(p, lanes, t_min, t_max, [&](int slot, int live) {
+        ray_lanes ccx(cx[slot]), ccy(cy[slot]), ccz(cz[slot]);
+        if (moving) {
+            ray_lanes s = (time - ray_lanes(time0[slot])) / ray_lanes(span[slot]);
+            ccx = ccx + s * ray_lanes(vx[slot]);
+            ccy = ccy + s * ray_lanes(vy[slot]);
+            ccz = ccz + s * ray_lanes(vz[slot]);
+        }
+        ray_lanes ocx = ox - ccx, ocy = oy - ccy, ocz = oz - ccz;
+        ray_lanes rad(radius[slot]);
+        ray_lanes b = ocx*dx + ocy*dy + ocz*dz;
+        ray_lanes c = ocx*ocx + ocy*ocy + ocz*ocz - rad*rad;
+        ray_lanes discriminant = b*b - a*c;
+        int candidates = lt_mask(zero, discriminant) & live;
+        if (!candidates)
+            return 0;
+        ray_lanes root = sqrt(max(discriminant, zero));
+        ray_lanes t_near = (zero - b - root) / a, t_far = (root - b) / a;
+        ray_lanes far_limit = ray_lanes::load(t_max);
+        int near_hits = candidates & lt_mask(t_near, far_limit) & lt_mask(near_limit, t_near);
+        int far_hits = candidates & ~near_hits & lt_mask(t_far, far_limit) & lt_mask(near_limit, t_far);
+        if (!(near_hits | far_hits))
+            return 0;
+        float tn[packet_size], tf[packet_size];
+        t_near.store(tn);
+        t_far.store(tf);
+        for (int k = 0; k < packet_size; k++) {
+            if (near_hits >> k & 1)
+                t_max[k] = tn[k];
+            else if (far_hits >> k & 1)
+                t_max[k] = tf[k];
+            else
+                continue;
+            closest[k] = slot;
+        }
+        return near_hits | far_hits;
+    });
+    for (int k = 0; k < packet_size; k++)
+        if (hits >> k & 1)
+            finish(p.lane(k), closest[k], t_max[k], rec[k]);
+    return hits;
+}
+
+#endif
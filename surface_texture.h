@@ -12,28 +12,27 @@
 //==================================================================================================
 
 #include "texture.h"
+#include "texture_cache.h"
 
 
+// An image file, looked up through the shared texture cache, so every
+// image_texture of the same file shares one copy of it, paged in a tile at a
+// time. It takes the nearest texel, or interpolates bilinearly when
+// texture_bilinear is set.
 class image_texture : public texture {
     public:
-        image_texture() {}
-        image_texture(unsigned char *pixels, int A, int B) : data(pixels), nx(A), ny(B) {}
-                virtual vec3 value(float u, float v, const vec3& p) const;
-        unsigned char *data;
-        int nx, ny;
+        image_texture() : image(-1) {}
+        image_texture(const char *filename) : image(shared_texture_cache().open(filename)) {}
+        virtual vec3 value(float u, float v, const vec3& p) const;
+        int image;
 };
 
 vec3 image_texture::value(float u, float v, const vec3& p) const {
-     int i = (  u)*nx;
-     int j = (1-v)*ny-0.001;
-     if (i < 0) i = 0;
-     if (j < 0) j = 0;
-     if (i > nx-1) i = nx-1;
-     if (j > ny-1) j = ny-1;
-     float r = int(data[3*i + 3*nx*j]  ) / 255.0;
-     float g = int(data[3*i + 3*nx*j+1]) / 255.0;
-     float b = int(data[3*i + 3*nx*j+2]) / 255.0;
-     return vec3(r, g, b);
+    if (image < 0)
+        return vec3(0, 0, 0);
+    if (texture_bilinear)
+        return shared_texture_cache().bilinear(image, u, v);
+    return shared_texture_cache().nearest(image, u, v);
 }
 
 #endif
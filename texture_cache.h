@@ -0,0 +1,274 @@
+#ifndef TEXTURECACHEH
+#define TEXTURECACHEH
+
+#include "vec3.h"
+
+#include <stb_image.h>
+#include <atomic>
+#include <list>
+#include <math.h>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+const int texture_tile_size = 64;  // texels on a side
+const int texture_tile_bytes = 3 * texture_tile_size * texture_tile_size;
+const int texture_cache_shards = 16;
+
+// Bytes of tiles the cache keeps in memory, over all images; set before
+// rendering. Each shard keeps at least one tile, so the effective minimum is
+// texture_cache_shards * texture_tile_bytes (192 KB).
+size_t texture_cache_budget = size_t(256) << 20;
+// image_texture takes the nearest texel unless this is set.
+bool texture_bilinear = false;
+
+struct texture_cache_stats {
+    long long hits, misses, evictions;
+    size_t resident, peak;  // bytes of tiles in memory
+};
+
+// Images by file name, each loaded once and cut into 64x64 RGB tiles. The
+// tiles live in a temporary backing file, and are read back on demand into
+// memory, which holds at most texture_cache_budget bytes of them; past that,
+// the least recently used tile makes room. The decoded image itself is only
+// held while open converts it. The tiles are split over shards, each with its
+// own lock and LRU list, so threads sampling different tiles rarely wait on
+// each other.
+//
+// Open every image before rendering starts: lookups may run on any number of
+// threads, open on one.
+class texture_cache {
+    public:
+        texture_cache() : backing(0), backing_size(0), resident(0), peak(0) {}
+        ~texture_cache() { if (backing) fclose(backing); }
+        // The image's id, or -1 if it can't be read.
+        int open(const char *filename);
+        int width(int image) const { return images[image].nx; }
+        int height(int image) const { return images[image].ny; }
+        // Lookups at u, v with v up, as image_texture has it.
+        vec3 nearest(int image, float u, float v);
+        vec3 bilinear(int image, float u, float v);
+        texture_cache_stats stats();
+        void print_stats(std::ostream& os);
+    private:
+        struct image_entry {
+            std::string name;
+            int nx, ny, tiles_x;
+            long long offset;  // of its first tile in the backing file
+        };
+        struct tile {
+            std::vector<unsigned char> texels;
+            std::list<uint64_t>::iterator lru;
+        };
+        struct shard {
+            shard() : bytes(0), hits(0), misses(0), evictions(0) {}
+            std::mutex lock;
+            std::list<uint64_t> lru;  // most recent first
+            std::unordered_map<uint64_t, tile> tiles;
+            size_t bytes;
+            long long hits, misses, evictions;
+        };
+        static uint64_t tile_key(int image, int tx, int ty) {
+            return uint64_t(image) << 48 | uint64_t(ty) << 24 | uint64_t(tx);
+        }
+        static size_t shard_budget() {
+            size_t budget = texture_cache_budget / texture_cache_shards;
+            return budget > size_t(texture_tile_bytes) ? budget : size_t(texture_tile_bytes);
+        }
+        shard& shard_of(uint64_t key) { return shards[(key * 0x9E3779B97F4A7C15ull) >> 60]; }
+        const unsigned char *find_tile(shard& s, uint64_t key, const image_entry& im, int tx, int ty);
+        void texels(int image, const int *xs, const int *ys, int n, vec3 *out);
+
+        std::vector<image_entry> images;
+        shard shards[texture_cache_shards];
+        std::mutex file_lock;
+        FILE *backing;
+        long long backing_size;
+        std::atomic<size_t> resident, peak;
+};
+
+texture_cache& shared_texture_cache() {
+    static texture_cache cache;
+    return cache;
+}
+
+bool seek_backing(FILE *f, long long offset) {
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+// Appends the image's tiles to the backing file, row by row. Tiles over the
+// edge are padded with the edge texels, so every tile is the same size.
+int texture_cache::open(const char *filename) {
+    for (size_t i = 0; i < images.size(); i++)
+        if (images[i].name == filename)
+            return int(i);
+    int nx, ny, nn;
+    unsigned char *pixels = stbi_load(filename, &nx, &ny, &nn, 3);
+    if (!pixels) {
+        fprintf(stderr, "texture_cache: can't load %s\n", filename);
+        return -1;
+    }
+    if (!backing && !(backing = tmpfile())) {
+        fprintf(stderr, "texture_cache: can't create a backing file for %s\n", filename);
+        stbi_image_free(pixels);
+        return -1;
+    }
+    image_entry im;
+    im.name = filename;
+    im.nx = nx;
+    im.ny = ny;
+    im.tiles_x = (nx + texture_tile_size - 1) / texture_tile_size;
+    im.offset = backing_size;
+    int tiles_y = (ny + texture_tile_size - 1) / texture_tile_size;
+    std::vector<unsigned char> texels(texture_tile_bytes);
+    std::lock_guard<std::mutex> hold(file_lock);
+    seek_backing(backing, backing_size);
+    for (int ty = 0; ty < tiles_y; ty++)
+        for (int tx = 0; tx < im.tiles_x; tx++) {
+            for (int y = 0; y < texture_tile_size; y++) {
+                int sy = ty * texture_tile_size + y < ny ? ty * texture_tile_size + y : ny - 1;
+                for (int x = 0; x < texture_tile_size; x++) {
+                    int sx = tx * texture_tile_size + x < nx ? tx * texture_tile_size + x : nx - 1;
+                    for (int c = 0; c < 3; c++)
+                        texels[3 * (y * texture_tile_size + x) + c] = pixels[3 * (size_t(sy) * nx + sx) + c];
+                }
+            }
+            fwrite(&texels[0], 1, texture_tile_bytes, backing);
+            backing_size += texture_tile_bytes;
+        }
+    stbi_image_free(pixels);
+    images.push_back(im);
+    return int(images.size()) - 1;
+}
+
+// With s locked; the texels stay put until s is unlocked.
+const unsigned char *texture_cache::find_tile(shard& s, uint64_t key, const image_entry& im, int tx, int ty) {
+    std::unordered_map<uint64_t, tile>::iterator found = s.tiles.find(key);
+    if (found != s.tiles.end()) {
+        s.hits++;
+        s.lru.splice(s.lru.begin(), s.lru, found->second.lru);
+        return &found->second.texels[0];
+    }
+    s.misses++;
+    std::vector<unsigned char> texels;
+    while (!s.lru.empty() && s.bytes + texture_tile_bytes > shard_budget()) {
+        // the evicted tile's memory is reused for the new one
+        std::unordered_map<uint64_t, tile>::iterator victim = s.tiles.find(s.lru.back());
+        texels.swap(victim->second.texels);
+        s.tiles.erase(victim);
+        s.lru.pop_back();
+        s.bytes -= texture_tile_bytes;
+        s.evictions++;
+        resident -= texture_tile_bytes;
+    }
+    texels.resize(texture_tile_bytes);
+    {
+        std::lock_guard<std::mutex> hold(file_lock);
+        if (!seek_backing(backing, im.offset + (long long)(ty * im.tiles_x + tx) * texture_tile_bytes)
+                || fread(&texels[0], 1, texture_tile_bytes, backing) != size_t(texture_tile_bytes))
+            fprintf(stderr, "texture_cache: can't read back a tile\n");
+    }
+    s.lru.push_front(key);
+    tile& t = s.tiles[key];
+    t.texels.swap(texels);
+    t.lru = s.lru.begin();
+    s.bytes += texture_tile_bytes;
+    size_t now = resident += texture_tile_bytes, highest = peak;
+    while (now > highest && !peak.compare_exchange_weak(highest, now))
+        ;
+    return &t.texels[0];
+}
+
+// Texels (xs[k], ys[k]) of image, already clamped to it, as 0..1 colours.
+void texture_cache::texels(int image, const int *xs, const int *ys, int n, vec3 *out) {
+    const image_entry& im = images[image];
+    std::unique_lock<std::mutex> held;
+    uint64_t held_key = 0;
+    const unsigned char *tile_texels = 0;
+    for (int k = 0; k < n; k++) {
+        int tx = xs[k] / texture_tile_size, ty = ys[k] / texture_tile_size;
+        uint64_t key = tile_key(image, tx, ty);
+        // neighbouring texels usually share a tile, which is looked up once
+        if (!tile_texels || key != held_key) {
+            shard& s = shard_of(key);
+            if (held.owns_lock())
+                held.unlock();
+            held = std::unique_lock<std::mutex>(s.lock);
+            tile_texels = find_tile(s, key, im, tx, ty);
+            held_key = key;
+        }
+        const unsigned char *p = tile_texels + 3 * ((ys[k] % texture_tile_size) * texture_tile_size + xs[k] % texture_tile_size);
+        out[k] = vec3(p[0], p[1], p[2]) / 255.0f;
+    }
+}
+
+inline int clamp_texel(int i, int n) {
+    return i < 0 ? 0 : i > n - 1 ? n - 1 : i;
+}
+
+// The texel image_texture has always taken.
+vec3 texture_cache::nearest(int image, float u, float v) {
+    const image_entry& im = images[image];
+    float x = u * im.nx;
+    double y = (1 - v) * im.ny - 0.001;
+    // also catches NaN
+    int i = x > 0 ? (x < im.nx - 1 ? int(x) : im.nx - 1) : 0;
+    int j = y > 0 ? (y < im.ny - 1 ? int(y) : im.ny - 1) : 0;
+    vec3 texel;
+    texels(image, &i, &j, 1, &texel);
+    return texel;
+}
+
+vec3 texture_cache::bilinear(int image, float u, float v) {
+    const image_entry& im = images[image];
+    float x = u * im.nx - 0.5f, y = (1 - v) * im.ny - 0.5f;
+    // also catches NaN
+    if (!(x > -1)) x = -1;
+    if (!(y > -1)) y = -1;
+    if (x > im.nx) x = float(im.nx);
+    if (y > im.ny) y = float(im.ny);
+    float fx = floor(x), fy = floor(y);
+    float wx = x - fx, wy = y - fy;
+    int x0 = clamp_texel(int(fx), im.nx), x1 = clamp_texel(int(fx) + 1, im.nx);
+    int y0 = clamp_texel(int(fy), im.ny), y1 = clamp_texel(int(fy) + 1, im.ny);
+    int xs[4] = { x0, x1, x0, x1 }, ys[4] = { y0, y0, y1, y1 };
+    vec3 texel[4];
+    texels(image, xs, ys, 4, texel);
+    vec3 top = (1 - wx) * texel[0] + wx * texel[1];
+    vec3 bottom = (1 - wx) * texel[2] + wx * texel[3];
+    return (1 - wy) * top + wy * bottom;
+}
+
+texture_cache_stats texture_cache::stats() {
+    texture_cache_stats st = { 0, 0, 0, 0, 0 };
+    for (int i = 0; i < texture_cache_shards; i++) {
+        std::lock_guard<std::mutex> hold(shards[i].lock);
+        st.hits += shards[i].hits;
+        st.misses += shards[i].misses;
+        st.evictions += shards[i].evictions;
+    }
+    st.resident = resident;
+    st.peak = peak;
+    return st;
+}
+
+void texture_cache::print_stats(std::ostream& os) {
+    if (images.empty())
+        return;
+    texture_cache_stats st = stats();
+    long long lookups = st.hits + st.misses;
+    os << "  texture cache: " << images.size() << " images, " << st.hits << " hits, " << st.misses << " misses ("
+       << (lookups ? 100.0 * st.misses / lookups : 0.0) << "%), " << st.evictions << " evictions, "
+       << st.peak / 1024 << " KB peak of " << texture_cache_shards * shard_budget() / 1024 << " KB\n";
+}
+
+#endif
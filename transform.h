@@ -0,0 +1,118 @@
+#ifndef TRANSFORMH
+#define TRANSFORMH
+
+#include "aabb.h"
+#include "vec3.h"
+
+#include <math.h>
+
+
+// An affine transform as a 3x4 matrix: the left 3x3 block is the linear part
+// and the last column the translation. a * b applies b first.
+class transform {
+    public:
+        transform() {
+            for (int i = 0; i < 3; i++)
+                for (int j = 0; j < 4; j++)
+                    m[i][j] = i == j;
+        }
+        vec3 point(const vec3& p) const {
+            return vec3(m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+                        m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+                        m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]);
+        }
+        vec3 vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+                        m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+                        m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+        }
+        // The transposed linear part times v. On an inverse transform this
+        // carries normals the other way.
+        vec3 transposed_vector(const vec3& v) const {
+            return vec3(m[0][0]*v[0] + m[1][0]*v[1] + m[2][0]*v[2],
+                        m[0][1]*v[0] + m[1][1]*v[1] + m[2][1]*v[2],
+                        m[0][2]*v[0] + m[1][2]*v[1] + m[2][2]*v[2]);
+        }
+        transform inverse() const;
+        aabb box(const aabb& b) const;
+
+        float m[3][4];
+};
+
+transform operator*(const transform& a, const transform& b) {
+    transform r;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++) {
+            r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+            if (j == 3)
+                r.m[i][j] += a.m[i][3];
+        }
+    return r;
+}
+
+transform transform::inverse() const {
+    float c[3][3];  // cofactors
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            int i1 = (i + 1) % 3, i2 = (i + 2) % 3, j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            c[i][j] = m[i1][j1]*m[i2][j2] - m[i1][j2]*m[i2][j1];
+        }
+    float det = m[0][0]*c[0][0] + m[0][1]*c[0][1] + m[0][2]*c[0][2];
+    transform r;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            r.m[i][j] = c[j][i] / det;
+    for (int i = 0; i < 3; i++)
+        r.m[i][3] = -(r.m[i][0]*m[0][3] + r.m[i][1]*m[1][3] + r.m[i][2]*m[2][3]);
+    return r;
+}
+
+// The box around the eight transformed corners of b.
+aabb transform::box(const aabb& b) const {
+    vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int k = 0; k < 8; k++) {
+        vec3 corner((k & 1 ? b.max() : b.min())[0], (k & 2 ? b.max() : b.min())[1], (k & 4 ? b.max() : b.min())[2]);
+        vec3 p = point(corner);
+        for (int a = 0; a < 3; a++) {
+            lo[a] = ffmin(lo[a], p[a]);
+            hi[a] = ffmax(hi[a], p[a]);
+        }
+    }
+    return aabb(lo, hi);
+}
+
+transform translation(const vec3& offset) {
+    transform t;
+    for (int i = 0; i < 3; i++)
+        t.m[i][3] = offset[i];
+    return t;
+}
+
+transform scaling(const vec3& s) {
+    transform t;
+    for (int i = 0; i < 3; i++)
+        t.m[i][i] = s[i];
+    return t;
+}
+
+// Turns angle degrees about axis, counterclockwise looking down the axis
+// towards the origin.
+transform rotation(const vec3& axis, float angle) {
+    float radians = (3.1416f / 180.) * angle;
+    float s = sin(radians), c = cos(radians);
+    vec3 u = unit_vector(axis);
+    transform t;
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            t.m[i][j] = (1 - c)*u[i]*u[j] + (i == j ? c : 0);
+    t.m[0][1] -= s*u[2]; t.m[1][0] += s*u[2];
+    t.m[0][2] += s*u[1]; t.m[2][0] -= s*u[1];
+    t.m[1][2] -= s*u[0]; t.m[2][1] += s*u[0];
+    return t;
+}
+
+transform rotation_y(float angle) {
+    return rotation(vec3(0, 1, 0), angle);
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef TRIANGLEMESHH
+#define TRIANGLEMESHH
+
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <atomic>
+#include <map>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+
+// Vertex attributes in separate arrays so several meshes can share them.
+// normals and uvs are either empty or have one entry per position.
+struct mesh_buffers {
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;
+    std::vector<float> uvs;  // u, v pairs
+    size_t memory_bytes() const {
+        return (positions.capacity() + normals.capacity()) * sizeof(vec3) + uvs.capacity() * sizeof(float);
+    }
+};
+
+// Triangles in the meshes built since these were last zeroed, and the bytes
+// the meshes held right after, as the benchmark reports per scene.
+std::atomic<long long> mesh_triangles_built(0), mesh_bytes_built(0);
+
+struct mesh_triangle {
+    int v[3];
+};
+
+// A triangle is three vertex indices; the mesh keeps its own BVH over them and
+// stores the triangles in leaf order, so the tree needs no index array.
+class triangle_mesh : public hittable {
+    public:
+        triangle_mesh() {}
+        triangle_mesh(mesh_buffers *b, const std::vector<mesh_triangle>& tris, material *m)
+            : buffers(b), mat_ptr(m) { build(tris); }
+        void build(const std::vector<mesh_triangle>& tris);
+        virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const;
+        virtual bool bounding_box(float t0, float t1, aabb& box) const;
+        virtual void update_bounds(float time0, float time1);
+        virtual size_t memory_bytes() const;
+        mesh_buffers *buffers;
+        std::vector<mesh_triangle> triangles;
+        wide_tree tree;
+        material *mat_ptr;
+        float built_cost = 0;
+};
+
+void triangle_mesh::build(const std::vector<mesh_triangle>& tris) {
+    int n = int(tris.size());
+    std::vector<bvh_primitive> prims(n);
+    const int chunk = 4096;
+    parallel_for((n + chunk - 1) / chunk, [&](int c) {
+        int end = (c + 1) * chunk < n ? (c + 1) * chunk : n;
+        for (int i = c * chunk; i < end; i++) {
+            aabb box = empty_box();
+            for (int k = 0; k < 3; k++)
+                grow_box(box, buffers->positions[tris[i].v[k]]);
+            prims[i] = make_bvh_primitive(box, i);
+        }
+    });
+    bvh_tree binary;
+    binary.max_leaf_size = 8;
+    binary.build(prims);
+    triangles.resize(binary.order.size());
+    for (size_t slot = 0; slot < binary.order.size(); slot++)
+        triangles[slot] = tris[binary.order[slot]];
+    tree.collapse(binary);
+    std::vector<wide_bvh_node<bvh_width> >(tree.nodes).swap(tree.nodes);
+    built_cost = tree.sah_cost();
+    mesh_triangles_built += n;
+    mesh_bytes_built += (long long)memory_bytes();
+}
+
+// For a mesh whose positions have been rewritten in place, e.g. by skinning.
+// The triangles keep their slots, so only the boxes change, unless the refit
+// tree has become bvh_refit_limit times worse than a fresh one.
+void triangle_mesh::update_bounds(float time0, float time1) {
+    const std::vector<vec3>& P = buffers->positions;
+    tree.refit([&](int slot) {
+        const mesh_triangle& tri = triangles[slot];
+        aabb box(P[tri.v[0]], P[tri.v[0]]);
+        grow_box(box, P[tri.v[1]]);
+        grow_box(box, P[tri.v[2]]);
+        return box;
+    });
+    if (tree.sah_cost() > bvh_refit_limit * built_cost) {
+        std::vector<mesh_triangle> tris(triangles);
+        build(tris);
+    }
+}
+
+bool triangle_mesh::bounding_box(float t0, float t1, aabb& box) const {
+    if (triangles.empty())
+        return false;
+    box = tree.bounds();
+    return true;
+}
+
+// Moller-Trumbore. Only t and the barycentrics are kept while searching;
+// the hit point, normal and uv are worked out once for the closest triangle.
+bool triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const {
+    const std::vector<vec3>& P = buffers->positions;
+    int closest = -1;
+    float hit_t = 0, hit_b1 = 0, hit_b2 = 0;
+    tree.intersect(r, t_min, t_max, [&](int slot, float& t_closest) {
+        const mesh_triangle& tri = triangles[slot];
+        vec3 p0 = P[tri.v[0]];
+        vec3 e1 = P[tri.v[1]] - p0;
+        vec3 e2 = P[tri.v[2]] - p0;
+        vec3 pv = cross(r.direction(), e2);
+        float det = dot(e1, pv);
+        if (det == 0)
+            return false;
+        float inv_det = 1 / det;
+        vec3 tv = r.origin() - p0;
+        float b1 = dot(tv, pv) * inv_det;
+        if (b1 < 0 || b1 > 1)
+            return false;
+        vec3 qv = cross(tv, e1);
+        float b2 = dot(r.direction(), qv) * inv_det;
+        if (b2 < 0 || b1 + b2 > 1)
+            return false;
+        float t = dot(e2, qv) * inv_det;
+        if (t < t_min || t > t_closest)
+            return false;
+        t_closest = t;
+        closest = slot;
+        hit_t = t;
+        hit_b1 = b1;
+        hit_b2 = b2;
+        return true;
+    });
+    if (closest < 0)
+        return false;
+    const mesh_triangle& tri = triangles[closest];
+    float b0 = 1 - hit_b1 - hit_b2;
+    vec3 p0 = P[tri.v[0]], p1 = P[tri.v[1]], p2 = P[tri.v[2]];
+    rec.t = hit_t;
+    rec.p = r.point_at_parameter(hit_t);
+    vec3 n(0, 0, 0);
+    if (!buffers->normals.empty())
+        n = b0*buffers->normals[tri.v[0]] + hit_b1*buffers->normals[tri.v[1]] + hit_b2*buffers->normals[tri.v[2]];
+    if (n.squared_length() == 0)
+        n = cross(p1 - p0, p2 - p0);
+    rec.normal = unit_vector(n);
+    if (buffers->uvs.empty()) {
+        rec.u = hit_b1;
+        rec.v = hit_b2;
+    }
+    else {
+        const float *uv = &buffers->uvs[0];
+        rec.u = b0*uv[2*tri.v[0]] + hit_b1*uv[2*tri.v[1]] + hit_b2*uv[2*tri.v[2]];
+        rec.v = b0*uv[2*tri.v[0]+1] + hit_b1*uv[2*tri.v[1]+1] + hit_b2*uv[2*tri.v[2]+1];
+    }
+    rec.mat_ptr = mat_ptr;
+    return true;
+}
+
+// Triangles plus acceleration structure; shared vertex buffers are not counted.
+size_t triangle_mesh::memory_bytes() const {
+    return triangles.capacity() * sizeof(mesh_triangle) + tree.memory_bytes();
+}
+
+
+// Reads v, vt, vn and f records from a Wavefront OBJ file and appends them to
+// buffers, triangulating polygons as fans. Corners with the same v/vt/vn triple
+// share a vertex; missing normals are stored as zero and fall back to the face
+// normal. A face with an index out of range is reported and skipped. Returns 0
+// if the file cannot be opened.
+triangle_mesh *load_obj(const char *filename, mesh_buffers *buffers, material *m) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        std::cerr << "could not open " << filename << "\n";
+        return 0;
+    }
+    std::vector<vec3> v, vn;
+    std::vector<float> vt;
+    std::map<std::pair<long long, int>, int> vertex_of;  // v/vt/vn -> vertex index
+    bool was_empty = buffers->positions.empty();
+    buffers->normals.resize(buffers->positions.size(), vec3(0, 0, 0));
+    buffers->uvs.resize(2 * buffers->positions.size(), 0.0f);
+    std::vector<mesh_triangle> tris;
+    bool has_uv = false, has_normal = false;
+    char line[1024];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_number++;
+        float x, y, z;
+        if (sscanf(line, "v %f %f %f", &x, &y, &z) == 3)
+            v.push_back(vec3(x, y, z));
+        else if (sscanf(line, "vn %f %f %f", &x, &y, &z) == 3)
+            vn.push_back(vec3(x, y, z));
+        else if (sscanf(line, "vt %f %f", &x, &y) == 2) {
+            vt.push_back(x);
+            vt.push_back(y);
+        }
+        else if (line[0] == 'f' && line[1] == ' ') {
+            std::vector<int> refs;  // v, vt, vn per corner; 0 for a missing vt or vn
+            bool valid = true;
+            for (char *tok = strtok(line + 2, " \t\r\n"); tok; tok = strtok(0, " \t\r\n")) {
+                int iv = 0, it = 0, in = 0;
+                if (sscanf(tok, "%d/%d/%d", &iv, &it, &in) != 3 && sscanf(tok, "%d//%d", &iv, &in) != 2 &&
+                    sscanf(tok, "%d/%d", &iv, &it) != 2)
+                    sscanf(tok, "%d", &iv);
+                if (iv < 0) iv += int(v.size()) + 1;
+                if (it < 0) it += int(vt.size() / 2) + 1;
+                if (in < 0) in += int(vn.size()) + 1;
+                if (iv < 1 || iv > int(v.size()) || it < 0 || it > int(vt.size() / 2) || in < 0 || in > int(vn.size()))
+                    valid = false;
+                refs.push_back(iv);
+                refs.push_back(it);
+                refs.push_back(in);
+            }
+            if (!valid) {
+                std::cerr << filename << ":" << line_number << ": face index out of range, face skipped\n";
+                continue;
+            }
+            std::vector<int> corners;
+            for (size_t c = 0; c < refs.size(); c += 3) {
+                int iv = refs[c], it = refs[c + 1], in = refs[c + 2];
+                has_uv = has_uv || it > 0;
+                has_normal = has_normal || in > 0;
+                std::pair<long long, int> key(((long long)iv << 32) | unsigned(it), in);
+                std::map<std::pair<long long, int>, int>::iterator found = vertex_of.find(key);
+                if (found == vertex_of.end()) {
+                    int index = int(buffers->positions.size());
+                    buffers->positions.push_back(v[iv - 1]);
+                    buffers->normals.push_back(in > 0 ? vn[in - 1] : vec3(0, 0, 0));
+                    buffers->uvs.push_back(it > 0 ? vt[2*(it - 1)] : 0);
+                    buffers->uvs.push_back(it > 0 ? vt[2*(it - 1) + 1] : 0);
+                    found = vertex_of.insert(std::make_pair(key, index)).first;
+                }
+                corners.push_back(found->second);
+            }
+            for (size_t k = 2; k < corners.size(); k++) {
+                mesh_triangle tri = { { corners[0], corners[k - 1], corners[k] } };
+                tris.push_back(tri);
+            }
+        }
+    }
+    fclose(f);
+    if (was_empty && !has_normal)
+        std::vector<vec3>().swap(buffers->normals);
+    if (was_empty && !has_uv)
+        std::vector<float>().swap(buffers->uvs);
+    return scene_new<triangle_mesh>(buffers, tris, m);
+}
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef WAVEFRONTH
+#define WAVEFRONTH
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "image_output.h"
+#include "integrator.h"
+#include "render.h"
+#include "progressive.h"
+
+#include <atomic>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+
+// Breadth-first path tracing. Rather than following each path to its end, a
+// queue of paths moves forward one bounce at a time, and every stage runs over
+// the whole queue before the next one starts:
+//   generate   camera rays for a run of samples of every pixel of a tile
+//   intersect  the live paths' rays, camera rays in packets
+//   shade      emission, scattering and light sampling, paths sorted by material
+//   shadow     the shadow rays of next-event estimation
+//   extend     new directions after diffuse bounces, and Russian roulette
+// Each worker runs its own queue over one tile at a time. A queue holds up to
+// wavefront_paths paths, few enough that its states stay in cache between
+// stages; a tile with more samples than that takes several runs.
+// Each path carries its own random sequence and draws from it in the same
+// order trace_path does, so the image is the one trace_samples would give.
+// Adaptive sampling and progressive rendering stay with the per-pixel renderer.
+bool wavefront = false;
+int wavefront_paths = 1 << 10;
+
+struct wavefront_path {
+    ray r;
+    hit_record hrec;
+    scatter_record srec;
+    ray scattered;
+    ray shadow;
+    vec3 throughput;
+    vec3 radiance;
+    vec3 shadow_attenuation;  // throughput times the material's attenuation
+    float shadow_scale;       // brdf times the MIS weight over the light pdf
+    vec3 scatter_p;
+    float scatter_pdf;
+    int depth;
+    bool hit;
+    bool alive;
+    bool diffuse;             // extend picks the next direction from srec
+    bool shadow_pending;
+    pcg32 rng;
+};
+
+class wavefront_queue {
+    public:
+        wavefront_queue(hittable *w, const light_list *l, path_estimator m)
+            : world(w), lights(l), mode(m), rays(0) {
+            sample_lights = mode == estimator_TheRestOfYourLife && lights && !lights->empty();
+        }
+        void render_tile(framebuffer& fb, int ns, camera& cam, int x0, int x1, int row0, int row1);
+
+        hittable *world;
+        const light_list *lights;
+        path_estimator mode;
+        bool sample_lights;
+        long long rays;
+        std::vector<wavefront_path> paths;  // sample s0+k of pixel n of the tile is paths[n*run + k]
+        std::vector<int> active;
+        std::vector<int> shadows;
+        std::vector<int> sorted, sorted_type;  // scratch for sort_by_material
+    private:
+        template <typename F>
+        void each(const std::vector<int>& list, F fn);
+        void intersect(const std::vector<int>& list, bool shadow_rays, bool coherent);
+        void take_hit(wavefront_path& path, bool shadow_rays, bool hit, const hit_record& rec);
+        void sort_by_material();
+        void shade(wavefront_path& path);
+        void extend(wavefront_path& path);
+};
+
+// Calls fn on the paths in list, each with its own random sequence swapped in
+// as the thread's.
+template <typename F>
+void wavefront_queue::each(const std::vector<int>& list, F fn) {
+    for (size_t n = 0; n < list.size(); n++) {
+        wavefront_path& path = paths[list[n]];
+        std::swap(thread_rng(), path.rng);
+        fn(path);
+        std::swap(thread_rng(), path.rng);
+    }
+}
+
+// A path's ray gets its hit record; a shadow ray that reaches an emitter adds
+// its light to the path.
+void wavefront_queue::take_hit(wavefront_path& path, bool shadow_rays, bool hit, const hit_record& rec) {
+    if (!shadow_rays) {
+        path.hit = hit;
+        if (hit)
+            path.hrec = rec;
+    }
+    else if (hit) {
+        vec3 emitted = rec.mat_ptr->emitted(path.shadow, rec, rec.u, rec.v, rec.p);
+        path.radiance += path.shadow_attenuation * emitted * path.shadow_scale;
+    }
+}
+
+// Casts the ray, or the shadow ray, of every path in list. Coherent rays (the
+// camera's) go packet_size paths to a packet; the rest one at a time, since
+// packets of rays heading every which way cost more than they share.
+void wavefront_queue::intersect(const std::vector<int>& list, bool shadow_rays, bool coherent) {
+    int count = int(list.size());
+    rays += count;
+    if (!coherent || !packet_tracing) {
+        each(list, [&](wavefront_path& path) {
+            hit_record rec;
+            bool hit = world->hit(shadow_rays ? path.shadow : path.r, 0.001f, FLT_MAX, rec);
+            take_hit(path, shadow_rays, hit, rec);
+        });
+        return;
+    }
+    for (int first = 0; first < count; first += packet_size) {
+        int n = count - first < packet_size ? count - first : packet_size;
+        ray_packet p;
+        pcg32 rng[packet_size];
+        float t_max[packet_size];
+        hit_record rec[packet_size];
+        for (int k = 0; k < n; k++) {
+            wavefront_path& path = paths[list[first + k]];
+            p.set(k, shadow_rays ? path.shadow : path.r);
+            rng[k] = path.rng;
+            t_max[k] = FLT_MAX;
+        }
+        p.rng = rng;
+        int hits = world->hit_packet(p, (1 << n) - 1, 0.001f, t_max, rec);
+        for (int k = 0; k < n; k++) {
+            wavefront_path& path = paths[list[first + k]];
+            path.rng = rng[k];
+            take_hit(path, shadow_rays, (hits >> k & 1) != 0, rec[k]);
+        }
+    }
+}
+
+// Groups the live paths by the type of material they hit, so shade runs the
+// same scatter code over long runs of paths. There are only a few types, so a
+// counting sort does it in two passes; paths keep their order within a type.
+void wavefront_queue::sort_by_material() {
+    std::vector<const std::type_info*> types(1, (const std::type_info*)0);  // 0 for misses
+    std::vector<int> count(1, 0);
+    sorted_type.resize(active.size());
+    for (size_t n = 0; n < active.size(); n++) {
+        const wavefront_path& path = paths[active[n]];
+        const std::type_info *type = path.hit ? &typeid(*path.hrec.mat_ptr) : 0;
+        size_t t = 0;
+        while (t < types.size() && !(types[t] == type || (type && types[t] && *types[t] == *type)))
+            t++;
+        if (t == types.size()) {
+            types.push_back(type);
+            count.push_back(0);
+        }
+        count[t]++;
+        sorted_type[n] = int(t);
+    }
+    int start = 0;
+    for (size_t t = 0; t < count.size(); t++) {
+        int c = count[t];
+        count[t] = start;
+        start += c;
+    }
+    sorted.resize(active.size());
+    for (size_t n = 0; n < active.size(); n++)
+        sorted[count[sorted_type[n]]++] = active[n];
+    active.swap(sorted);
+}
+
+// Everything trace_path does at a hit up to the shadow ray.
+void wavefront_queue::shade(wavefront_path& path) {
+    const ray& r = path.r;
+    hit_record& hrec = path.hrec;
+    path.diffuse = false;
+    path.shadow_pending = false;
+    if (!path.hit) {
+        if (mode == estimator_InOneWeekend)
+            path.radiance += path.throughput * sky_color(r);
+        path.alive = false;
+        return;
+    }
+    if (mode != estimator_InOneWeekend) {
+        vec3 emitted = hrec.mat_ptr->emitted(r, hrec, hrec.u, hrec.v, hrec.p);
+        if (sample_lights && path.scatter_pdf > 0 && !is_black(emitted))
+            emitted *= power_heuristic(path.scatter_pdf, lights->pdf_value(path.scatter_p, r.direction()));
+        path.radiance += path.throughput * emitted;
+    }
+    if (path.depth >= max_depth) {
+        path.alive = false;
+        return;
+    }
+    if (mode != estimator_TheRestOfYourLife) {
+        vec3 attenuation;
+        if (!hrec.mat_ptr->scatter_InOneWeekend(r, hrec, attenuation, path.scattered)) {
+            path.alive = false;
+            return;
+        }
+        path.throughput *= attenuation;
+        return;
+    }
+    scatter_record& srec = path.srec;
+    if (!hrec.mat_ptr->scatter(r, hrec, srec)) {
+        path.alive = false;
+        return;
+    }
+    if (srec.is_specular) {
+        path.scattered = srec.specular_ray;
+        path.throughput *= srec.attenuation;
+        path.scatter_pdf = 0;
+        return;
+    }
+    if (sample_lights) {
+        path.shadow = ray(hrec.p, lights->random(hrec.p), r.time());
+        float light_pdf = lights->pdf_value(hrec.p, path.shadow.direction());
+        float brdf = hrec.mat_ptr->scattering_pdf(r, hrec, path.shadow);
+        if (light_pdf > 0 && brdf > 0) {
+            float weight = power_heuristic(light_pdf, srec.sampling_pdf.value(path.shadow.direction()));
+            path.shadow_attenuation = path.throughput * srec.attenuation;
+            path.shadow_scale = brdf * weight / light_pdf;
+            path.shadow_pending = true;
+        }
+    }
+    path.diffuse = true;
+}
+
+// The rest of trace_path's bounce, after the shadow ray.
+void wavefront_queue::extend(wavefront_path& path) {
+    if (path.diffuse) {
+        const hit_record& hrec = path.hrec;
+        scatter_record& srec = path.srec;
+        path.scattered = ray(hrec.p, srec.sampling_pdf.generate(), path.r.time());
+        float pdf_val = srec.sampling_pdf.value(path.scattered.direction());
+        path.throughput *= srec.attenuation * hrec.mat_ptr->scattering_pdf(path.r, hrec, path.scattered) / pdf_val;
+        path.scatter_p = hrec.p;
+        path.scatter_pdf = pdf_val;
+    }
+    if (path.depth + 1 >= roulette_depth) {
+        vec3& throughput = path.throughput;
+        float q = ffmax(throughput.x(), ffmax(throughput.y(), throughput.z()));
+        if (q < 1) {
+            if (random_double() >= q) {
+                path.alive = false;
+                return;
+            }
+            throughput /= q;
+        }
+    }
+    path.r = path.scattered;
+    path.depth++;
+}
+
+// Renders the tile [x0, x1) x [row0, row1) of fb, rows counted from the top,
+// ns samples per pixel, in runs of as many samples as fit in the queue. Each
+// pixel's samples are summed in order, as sample_pixel does.
+void wavefront_queue::render_tile(framebuffer& fb, int ns, camera& cam, int x0, int x1, int row0, int row1) {
+    int width = x1 - x0;
+    int pixels = width * (row1 - row0);
+    int run = wavefront_paths / pixels;
+    if (run < 1)
+        run = 1;
+    if (run > ns)
+        run = ns;
+    std::vector<vec3> sum(pixels, vec3(0, 0, 0));
+    paths.resize(size_t(pixels) * run);
+    for (int s0 = 0; s0 < ns; s0 += run) {
+        int n = ns - s0 < run ? ns - s0 : run;
+        int count = pixels * n;
+        active.resize(count);
+        for (int slot = 0; slot < count; slot++)
+            active[slot] = slot;
+        each(active, [&](wavefront_path& path) {
+            int slot = int(&path - &paths[0]);
+            int pixel = slot / n;
+            int i = x0 + pixel % width;
+            int j = fb.ny - 1 - (row0 + pixel / width);
+            seed_sample(i, j, s0 + slot % n);
+            float u = float(i + random_double()) / float(fb.nx);
+            float v = float(j + random_double()) / float(fb.ny);
+            path.r = cam.get_ray(u, v);
+            path.throughput = vec3(1, 1, 1);
+            path.radiance = vec3(0, 0, 0);
+            path.scatter_pdf = 0;
+            path.depth = 0;
+            path.alive = true;
+        });
+
+        for (int depth = 0; !active.empty(); depth++) {
+            intersect(active, false, depth == 0);
+            sort_by_material();
+            each(active, [&](wavefront_path& path) { shade(path); });
+            shadows.clear();
+            for (size_t k = 0; k < active.size(); k++)
+                if (paths[active[k]].alive && paths[active[k]].shadow_pending)
+                    shadows.push_back(active[k]);
+            intersect(shadows, true, false);
+            size_t live = 0;
+            for (size_t k = 0; k < active.size(); k++)
+                if (paths[active[k]].alive)
+                    active[live++] = active[k];
+            active.resize(live);
+            each(active, [&](wavefront_path& path) { extend(path); });
+            live = 0;
+            for (size_t k = 0; k < active.size(); k++)
+                if (paths[active[k]].alive)
+                    active[live++] = active[k];
+            active.resize(live);
+        }
+
+        for (int pixel = 0; pixel < pixels; pixel++)
+            for (int k = 0; k < n; k++)
+                sum[pixel] += de_nan(paths[pixel * n + k].radiance);
+    }
+
+    for (int pixel = 0; pixel < pixels; pixel++) {
+        int row = row0 + pixel / width;
+        int i = x0 + pixel % width;
+        fb.at(i, row) = sum[pixel] / float(ns);
+        fb.sample_count[size_t(row) * fb.nx + i] = ns;
+    }
+}
+
+// Renders fb with the wavefront engine, one queue per tile, streaming each band
+// of tiles to out as it is finished.
+void render_wavefront(framebuffer& fb, int ns, camera& cam, hittable *world, const light_list *lights,
+                      path_estimator mode, image_output *out, long long *rays = 0) {
+    std::atomic<long long> total(0);
+    for_each_tile(fb, [&](int x0, int x1, int row0, int row1) {
+        wavefront_queue queue(world, lights, mode);
+        queue.render_tile(fb, ns, cam, x0, x1, row0, row1);
+        total += queue.rays;
+    }, out);
+    if (rays)
+        *rays += total;
+}
+
+// Renders ns samples per pixel of world seen through cam into fb: with the
+// wavefront engine when wavefront is set and neither adaptive sampling nor
+// progressive rendering is, otherwise pixel by pixel with trace_samples.
+void render_camera(framebuffer& fb, int ns, camera& cam, hittable *world, const light_list *lights,
+                   path_estimator mode, image_output *out) {
+    if (wavefront && !adaptive_sampling && !progressive) {
+        render_wavefront(fb, ns, cam, world, lights, mode, out);
+        return;
+    }
+    // enough of the setup to tell a checkpoint of another scene or view apart
+    uint64_t fingerprint = add_fingerprint(add_fingerprint(0, cam), int(mode));
+    aabb box;
+    if (world->bounding_box(cam.time0, cam.time1, box))
+        fingerprint = add_fingerprint(add_fingerprint(fingerprint, box.min()), box.max());
+    if (lights)
+        fingerprint = add_fingerprint(fingerprint, lights->lights.size());
+    render_image(fb, ns, [&](int i, int j, int s0, int n, vec3 *col) {
+        trace_samples(cam, fb.nx, fb.ny, i, j, s0, n, world, lights, mode, col);
+    }, out, fingerprint);
+}
+
+#endif